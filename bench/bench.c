@@ -0,0 +1,229 @@
+/**
+ * @file
+ * @brief Throughput and latency benchmark for every size class.
+ *
+ * Runs seven access patterns and prints, per pattern, the throughput, the bus
+ * transactions (START conditions) per KB and the write cycles per KB:
+ *  - seq write:    one eeprom_write() over the test span
+ *  - page write:   page sized writes at page aligned addresses
+ *  - unaligned:    page sized writes starting half way into a page
+ *  - seq read:     one eeprom_read() over the test span
+ *  - byte read:    eeprom_byte_read() at pseudo random addresses
+ *  - small read:   4 byte eeprom_read() calls at consecutive addresses, as a record parser does
+ *  - byte write:   eeprom_byte_write() at consecutive addresses
+ *
+ * On the host the simulator stands in for the bus and every size from 1K to 1M is
+ * run. On hardware the part fitted at EEPROM_ADDRESS is run, timed with Timer1, and
+ * the table goes out over the UART. Counters come from EEPROM_STATS in both cases,
+ * so the tables can be compared line by line.
+ *
+ * @code
+ * cc -O2 -I.. bench.c -o bench && ./bench
+ * avr-gcc -mmcu=atmega328p -Os -DF_CPU=16000000UL -DEEPROM_KBITS=256 -I.. -I<path to i2cmaster> \
+ *     bench.c twimaster.c -o bench.elf
+ * @endcode
+ */
+#define EEPROM_STATS
+
+#include <stdio.h>
+#include <stdint.h>
+
+#if defined(__AVR__)
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <i2cmaster.h>
+#define BENCH_HOST          0
+#else
+#define EEPROM_BUS          EEPROM_BUS_SIM
+#define BENCH_HOST          1
+#endif
+#include "i2ceeprom.h"
+
+#ifndef EEPROM_ADDRESS
+#define EEPROM_ADDRESS      0xA0
+#endif
+#ifndef EEPROM_KBITS
+#define EEPROM_KBITS        256
+#endif
+#ifndef BENCH_SPEED_KHZ
+#define BENCH_SPEED_KHZ     400
+#endif
+#define BENCH_SPAN          1024            // bytes per pattern, less on small parts
+#define BENCH_BYTE_OPS      128             // operations of the byte patterns
+
+#if BENCH_HOST
+static uint32_t bench_now_us(void) {
+    return (uint32_t) (eeprom_sim_stats.time_ns / 1000);
+}
+#else
+#ifndef BAUD
+#define BAUD                38400UL
+#endif
+static volatile uint16_t bench_overflows;
+
+ISR(TIMER1_OVF_vect) {
+    ++bench_overflows;
+}
+
+static uint32_t bench_now_us(void) {
+    uint16_t high, low;
+
+    cli();
+    low = TCNT1;
+    high = bench_overflows;
+    if ((TIFR1 & (1 << TOV1)) && low < 0x8000) {
+        ++high;                                                 // overflow not serviced yet
+    }
+    sei();
+    return (((uint32_t) high << 16) | low) * 64 / (F_CPU / 1000000UL);
+}
+
+static int uart_putchar(char c, FILE *stream) {
+    (void) stream;
+    if (c == '\n') {
+        uart_putchar('\r', stream);
+    }
+    while (!(UCSR0A & (1 << UDRE0)));
+    UDR0 = c;
+    return 0;
+}
+
+static FILE uart_out = FDEV_SETUP_STREAM(uart_putchar, NULL, _FDEV_SETUP_WRITE);
+#endif
+
+static uint8_t bench_data[BENCH_SPAN];
+static uint16_t bench_seed;
+
+static uint16_t bench_random(void) {
+    bench_seed = bench_seed * 25173 + 13849;                     // same sequence on host and target
+    return bench_seed;
+}
+
+/**
+ * @brief  Print one line of the table
+ */
+static void bench_report(eeprom *a, const char *name, uint32_t bytes, uint32_t started_us) {
+    uint32_t elapsed = bench_now_us() - started_us;
+    eeprom_stats st;
+
+    eeprom_stats_get(a, &st);
+    printf("%5uK  %-10s %6lu %9lu %9lu %8lu\n", a->eeprom_size, name, (unsigned long) bytes,
+           (unsigned long) (elapsed ? bytes * 1000000ULL / elapsed : 0),
+           (unsigned long) (st.starts * 1024ULL / bytes),
+           (unsigned long) (st.page_writes * 1024ULL / bytes));
+    eeprom_stats_reset(a);
+}
+
+/**
+ * @brief  Let the last write cycle finish, so it is charged to the pattern that started it
+ */
+static void bench_settle(eeprom *a) {
+    eeprom_flush(a);
+    eeprom_wait(a);
+}
+
+/**
+ * @brief  Start timing a pattern on an idle part with clear counters
+ * @return Start time in us
+ */
+static uint32_t bench_start(eeprom *a) {
+    bench_settle(a);
+    eeprom_stats_reset(a);
+    return bench_now_us();
+}
+
+/**
+ * @brief  Run all patterns on one EEPROM
+ * @note   Write patterns end with bench_settle() inside their timed region, reads start
+ *         on an idle part, so no pattern measures the write cycles of another.
+ */
+static void bench_part(eeprom *a) {
+    uint32_t span = (uint32_t) a->eeprom_size * 128;
+    uint16_t page = a->geometry.page_size;
+    uint32_t t;
+    uint8_t byte;
+
+    if (span > BENCH_SPAN) {
+        span = BENCH_SPAN;
+    }
+    for (uint16_t i = 0; i < span; ++i) {
+        bench_data[i] = (uint8_t) bench_random();
+    }
+
+    t = bench_start(a);
+    eeprom_write(a, 0, bench_data, (uint16_t) span);
+    bench_settle(a);
+    bench_report(a, "seq write", span, t);
+
+    t = bench_start(a);
+    for (uint32_t address = 0; address + page <= span; address += page) {
+        eeprom_write(a, address, bench_data + address, page);
+    }
+    bench_settle(a);
+    bench_report(a, "page write", span, t);
+
+    t = bench_start(a);
+    for (uint32_t address = page / 2; address + page <= span; address += page) {
+        eeprom_write(a, address, bench_data + address, page);
+    }
+    bench_settle(a);
+    bench_report(a, "unaligned", span - page, t);
+
+    t = bench_start(a);
+    eeprom_read(a, 0, bench_data, (uint16_t) span);
+    bench_report(a, "seq read", span, t);
+
+    t = bench_start(a);
+    for (uint16_t i = 0; i < BENCH_BYTE_OPS; ++i) {
+        eeprom_byte_read(a, bench_random() % span, &byte);
+    }
+    bench_report(a, "byte read", BENCH_BYTE_OPS, t);
+
+    t = bench_start(a);
+    for (uint32_t address = 0; address + 4 <= span; address += 4) {
+        eeprom_read(a, address, bench_data + address, 4);
+    }
+    bench_report(a, "small read", span, t);
+
+    t = bench_start(a);
+    for (uint16_t i = 0; i < BENCH_BYTE_OPS; ++i) {
+        eeprom_byte_write(a, i % span, (uint8_t) i);
+    }
+    bench_settle(a);
+    bench_report(a, "byte write", BENCH_BYTE_OPS, t);
+}
+
+int main(void) {
+    eeprom eep;
+
+#if BENCH_HOST
+    static const uint16_t sizes[] = {1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024};
+
+    printf("simulated bus at %u kHz\n", BENCH_SPEED_KHZ);
+    printf(" size  pattern     bytes   bytes/s  starts/KB cycles/KB\n");
+    for (uint8_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        eeprom_sim_reset();
+        eeprom_sim_set_speed(BENCH_SPEED_KHZ);
+        eeprom_sim_attach(EEPROM_ADDRESS, sizes[i]);
+        eeprom_init(&eep, EEPROM_ADDRESS, sizes[i]);
+        bench_seed = 1;
+        bench_part(&eep);
+    }
+    return 0;
+#else
+    UBRR0 = (F_CPU / (16 * BAUD)) - 1;
+    UCSR0B = (1 << TXEN0);
+    stdout = &uart_out;
+    TCCR1A = 0;
+    TCCR1B = (1 << CS11) | (1 << CS10);                         // F_CPU / 64
+    TIMSK1 = (1 << TOIE1);
+    sei();
+
+    eeprom_init_speed(&eep, EEPROM_ADDRESS, EEPROM_KBITS, BENCH_SPEED_KHZ);
+    printf("bus at %u kHz\n", BENCH_SPEED_KHZ);
+    printf(" size  pattern     bytes   bytes/s  starts/KB cycles/KB\n");
+    bench_seed = 1;
+    bench_part(&eep);
+    for (;;);
+#endif
+}
@@ -0,0 +1,156 @@
+/**
+ * @file
+ * @brief Read latency: repeated START against STOP + START.
+ *
+ * Times eeprom_read(), which turns the bus around with a repeated START, against
+ * the old sequence that sent a STOP and then ACK-polled the device for the read,
+ * with the bus at 400 kHz. The difference is in the address phase, so every size
+ * class is run: 1 address byte with block bits up to 16K, 2 address bytes above.
+ *
+ * On the host the simulator stands in for the bus, every size from 1K to 1M is run
+ * and the table is in ns per call. On hardware the part fitted at EEPROM_ADDRESS is
+ * run, timed with Timer1, and the table goes out over the UART in CPU cycles per call.
+ *
+ * @code
+ * cc -O2 -I.. read_latency.c -o read_latency && ./read_latency
+ * avr-gcc -mmcu=atmega328p -Os -DF_CPU=16000000UL -DEEPROM_KBITS=256 -I.. -I<path to i2cmaster> \
+ *     read_latency.c twimaster.c -o read_latency.elf
+ * @endcode
+ */
+#include <stdio.h>
+#include <stdint.h>
+
+#if defined(__AVR__)
+#include <avr/io.h>
+#include <i2cmaster.h>
+#define LATENCY_HOST    0
+#else
+#define EEPROM_BUS      EEPROM_BUS_SIM
+#define LATENCY_HOST    1
+#endif
+#include "i2ceeprom.h"
+
+#ifndef EEPROM_ADDRESS
+#define EEPROM_ADDRESS  0xA0
+#endif
+#ifndef EEPROM_KBITS
+#define EEPROM_KBITS    256
+#endif
+#ifndef BAUD
+#define BAUD            38400UL
+#endif
+#define LATENCY_KHZ     400
+#define RUNS            32
+
+#if LATENCY_HOST
+#define LATENCY_UNIT    "ns"
+
+static uint32_t latency_now(void) {
+    return (uint32_t) eeprom_sim_stats.time_ns;
+}
+#else
+#define LATENCY_UNIT    "cycles"
+
+static uint32_t latency_now(void) {
+    return TCNT1 * 8UL;                                     // one count every 8 CPU cycles
+}
+
+static int uart_putchar(char c, FILE *stream) {
+    (void) stream;
+    if (c == '\n') {
+        uart_putchar('\r', stream);
+    }
+    while (!(UCSR0A & (1 << UDRE0)));
+    UDR0 = c;
+    return 0;
+}
+
+static FILE uart_out = FDEV_SETUP_STREAM(uart_putchar, NULL, _FDEV_SETUP_WRITE);
+#endif
+
+/**
+ * @brief  The read sequence used before the repeated START change
+ */
+static void read_stop_start(eeprom *a, uint32_t mem_address, uint8_t *data, uint16_t datasize) {
+    eeprom_select(a, a->geometry, mem_address);
+    eeprom_stop();
+    eeprom_bus_claim();                                                             // raw i2cmaster calls from here
+    i2c_start_wait(eeprom_device_address(a, a->geometry, mem_address) + I2C_READ);
+    while (datasize > 1) {
+        *data++ = i2c_readAck();
+        --datasize;
+    }
+    *data = i2c_readNak();
+    eeprom_stop();
+    eeprom_bus_release();
+}
+
+/**
+ * @brief  Average time of one read of datasize bytes
+ */
+static uint32_t time_read(eeprom *a, uint8_t rep_start, uint8_t *data, uint16_t datasize) {
+    uint32_t span = (uint32_t) a->eeprom_size * 128;
+    uint32_t elapsed = 0, started, address;
+
+    for (uint8_t i = 0; i < RUNS; ++i) {
+        address = ((uint32_t) i * 509 * datasize) % (span - datasize + 1);         // spread over the blocks
+#if !LATENCY_HOST
+        TCNT1 = 0;
+#endif
+        started = latency_now();
+        if (rep_start) {
+            eeprom_read(a, address, data, datasize);
+        } else {
+            read_stop_start(a, address, data, datasize);
+        }
+        elapsed += latency_now() - started;
+    }
+    return elapsed / RUNS;
+}
+
+/**
+ * @brief  Print the rows of one part
+ */
+static void latency_part(eeprom *a) {
+    static const uint16_t lengths[] = {1, 4, 16, 64};
+    static uint8_t data[64];
+
+    for (uint8_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); ++i) {
+        uint32_t old_time = time_read(a, 0, data, lengths[i]);
+        uint32_t new_time = time_read(a, 1, data, lengths[i]);
+
+        printf("%5uK  %5u  %5u  %10lu  %9lu  %6ld\n", a->eeprom_size, a->geometry.addr_bytes, lengths[i],
+               (unsigned long) old_time, (unsigned long) new_time, (long) (old_time - new_time));
+    }
+}
+
+int main(void) {
+    eeprom eep;
+
+#if LATENCY_HOST
+    static const uint16_t sizes[] = {1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024};
+
+    printf("simulated bus at %u kHz, %s per read\n", LATENCY_KHZ, LATENCY_UNIT);
+    printf(" size  addr   bytes  stop+start  rep-start   saved\n");
+    for (uint8_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        eeprom_sim_reset();
+        eeprom_sim_set_speed(LATENCY_KHZ);
+        eeprom_sim_attach(EEPROM_ADDRESS, sizes[i]);
+        eeprom_init_speed(&eep, EEPROM_ADDRESS, sizes[i], LATENCY_KHZ);
+        latency_part(&eep);
+    }
+    return 0;
+#else
+    UBRR0 = (F_CPU / (16 * BAUD)) - 1;
+    UCSR0B = (1 << TXEN0);
+    stdout = &uart_out;
+    TCCR1A = 0;
+    TCCR1B = (1 << CS11);
+
+    eeprom_init_speed(&eep, EEPROM_ADDRESS, EEPROM_KBITS, LATENCY_KHZ);
+    printf("bus at %u kHz, %s per read\n", LATENCY_KHZ, LATENCY_UNIT);
+    printf(" size  addr   bytes  stop+start  rep-start   saved\n");
+    latency_part(&eep);
+    for (;;);
+#endif
+}
@@ -41,6 +41,27 @@
  * @endcode
  */
 
+#ifndef I2CEEPROM_H
+#define I2CEEPROM_H
+
+// Bus backend. The library talks to the bus through the i2cmaster API only, which
+// every backend provides as plain functions, so the calls can be inlined.
+#define EEPROM_BUS_TWI                  0   // I2C Master library by Peter Fleury, included by the application
+#define EEPROM_BUS_SIM                  1   // Host simulator from i2ceeprom_sim.h
+#define EEPROM_BUS_USI                  2   // USI driver from i2ceeprom_usi.h, for ATtiny parts
+#define EEPROM_BUS_SOFT                 3   // Bit-banged driver on any two pins from i2ceeprom_soft.h
+#ifndef EEPROM_BUS
+#define EEPROM_BUS                      EEPROM_BUS_TWI
+#endif
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM                                                                 // flat address space off target
+#define pgm_read_byte(p)                (*(const uint8_t *) (p))
+#define pgm_read_word(p)                (*(const uint16_t *) (p))
+#endif
+
 // 1K, 2K       - 1 0 1 0  E2 E1 E0 RW
 // 4K           - 1 0 1 0  E2 E1 A8 RW
 // 8K           - 1 0 1 0  E2 A9 A8 RW
@@ -48,11 +69,140 @@
 // 32K, 64K     - 1 0 1 0  E2 E1 E0 RW
 // 128K, 256K   - 1 0 1 0   0 E1 E0 RW
 // 512K         - 1 0 1 0   0 E1 E0 RW
-// 1M           - 1 0 1 0   0 E1 E0 RW
+// 1M           - 1 0 1 0  E2 E1 A16 RW
 
 // Ex - Device Address selection bits
 // Ax - Memory Address selection bits
 
+// Geometry of a part, derived from its size in Kbits.
+// The block mask selects the memory address bits carried in the device address
+// (A8-A10 on 4K-16K parts, A16 on 1M parts). They sit just above the bits sent
+// as memory address bytes, so the shift is (8 * address bytes - 1).
+#define EEPROM_GEOM_PAGE_SIZE(kbits)    ((kbits) <= 2 ? 8 : (kbits) <= 16 ? 16 : (kbits) <= 64 ? 32 : \
+                                         (kbits) <= 256 ? 64 : (kbits) <= 512 ? 128 : 256)
+#define EEPROM_GEOM_ADDR_BYTES(kbits)   ((kbits) <= 16 ? 1 : 2)
+#define EEPROM_GEOM_BLOCK_MASK(kbits)   ((kbits) == 4 ? 0x2 : (kbits) == 8 ? 0x6 : (kbits) == 16 ? 0xE : \
+                                         (kbits) == 1024 ? 0x2 : 0x0)
+#define EEPROM_GEOM_VALID(kbits)        ((kbits) != 0 && (kbits) <= 1024 && ((kbits) & ((kbits) - 1)) == 0)
+
+#if EEPROM_BUS == EEPROM_BUS_SIM
+#include "i2ceeprom_sim.h"
+#elif EEPROM_BUS == EEPROM_BUS_USI
+#include "i2ceeprom_usi.h"
+#elif EEPROM_BUS == EEPROM_BUS_SOFT
+#include "i2ceeprom_soft.h"
+#endif
+
+/**
+ * @brief  Page size, address width and block-select bits of a part
+ * @note   Filled in by eeprom_init(), a page size of 0 marks an unsupported size
+ */
+typedef struct eeprom_geometry {
+    uint16_t page_size;                     // Page write size in bytes
+    uint8_t addr_bytes;                     // Number of memory address bytes (1 or 2)
+    uint8_t block_mask;                     // Memory address bits in the device address
+}eeprom_geometry;
+
+#if defined(__GNUC__)
+#define EEPROM_ALWAYS_INLINE            inline __attribute__((always_inline))
+#else
+#define EEPROM_ALWAYS_INLINE            inline
+#endif
+
+/**
+ * @brief  Geometry of a part of the given size
+ * @note   With a constant size this folds down to constants.
+ * @param  kbits: Size of the EEPROM in Kbits
+ * @return Geometry of the part
+ */
+static EEPROM_ALWAYS_INLINE eeprom_geometry eeprom_geometry_of(uint16_t kbits) {
+    eeprom_geometry g;
+    g.page_size = EEPROM_GEOM_VALID(kbits) ? EEPROM_GEOM_PAGE_SIZE(kbits) : 0;
+    g.addr_bytes = EEPROM_GEOM_ADDR_BYTES(kbits);
+    g.block_mask = EEPROM_GEOM_BLOCK_MASK(kbits);
+    return g;
+}
+
+/**
+ * @brief  Status of a transfer
+ */
+typedef enum eeprom_status {
+    EEPROM_OK = 0,                          // Transfer completed
+    EEPROM_BUSY,                            // A transfer is still in progress
+    EEPROM_ERROR,                           // Bad arguments, unsupported size or bus error
+    EEPROM_TIMEOUT,                         // The device did not ACK its address within the poll budget
+    EEPROM_NACK                             // A memory address or data byte was not acknowledged
+}eeprom_status;
+
+// ACK-poll attempts allowed before a transfer gives up with EEPROM_TIMEOUT. One attempt
+// is a START, the device address and a STOP, about 28 us at 400 kHz, so the default
+// covers a 5 ms write cycle at up to 1 MHz with room to spare. 0 polls forever.
+#ifndef EEPROM_POLL_RETRIES
+#define EEPROM_POLL_RETRIES             1000
+#endif
+
+// Write-back cache, set EEPROM_CACHE_PAGES to 1..8 before including this file to enable it.
+// Each line holds EEPROM_CACHE_PAGE_SIZE bytes, or one page on parts with smaller pages.
+#ifndef EEPROM_CACHE_PAGES
+#define EEPROM_CACHE_PAGES              0
+#endif
+#ifndef EEPROM_CACHE_PAGE_SIZE
+#define EEPROM_CACHE_PAGE_SIZE          32
+#endif
+
+#if EEPROM_CACHE_PAGES > 8
+#error "EEPROM_CACHE_PAGES must be 8 or less"
+#endif
+#if (EEPROM_CACHE_PAGE_SIZE & (EEPROM_CACHE_PAGE_SIZE - 1)) != 0 || EEPROM_CACHE_PAGE_SIZE > 256
+#error "EEPROM_CACHE_PAGE_SIZE must be a power of two up to 256"
+#endif
+
+// Read-ahead buffer, set EEPROM_READAHEAD to 16..64 bytes before including this file to
+// enable it. A short read that misses, and starts where the previous read ended, fetches
+// a whole buffer instead. Reads at scattered addresses go to the chip as they are.
+#ifndef EEPROM_READAHEAD
+#define EEPROM_READAHEAD                0
+#endif
+#if EEPROM_READAHEAD > 255
+#error "EEPROM_READAHEAD must be 255 or less"
+#endif
+
+#if EEPROM_CACHE_PAGES > 0 || EEPROM_READAHEAD > 0
+#include <string.h>
+#endif
+
+#if EEPROM_CACHE_PAGES > 0
+
+/**
+ * @brief  One cached page
+ */
+typedef struct eeprom_cache_line {
+    uint32_t base;                          // Address of the first byte of the line
+    uint16_t dirty_since;                   // Tick at which the line last went from clean to dirty
+    uint8_t data[EEPROM_CACHE_PAGE_SIZE];
+}eeprom_cache_line;
+#endif
+
+#ifdef EEPROM_STATS
+/**
+ * @brief  Access counters of an EEPROM
+ * @note   Define EEPROM_STATS before including this file to keep them. wait_ticks
+ *         counts in the unit of the eeprom_set_tick() source and stays 0 without one.
+ */
+typedef struct eeprom_stats {
+    uint32_t bytes_read;                    // Data bytes received
+    uint32_t bytes_written;                 // Data bytes sent
+    uint32_t page_writes;                   // Write cycles started
+    uint32_t starts;                        // START and repeated START conditions
+    uint32_t ack_polls;                     // Addressing attempts NACKed by a busy device
+    uint32_t wait_ticks;                    // Time spent waiting for write cycles
+}eeprom_stats;
+
+#define EEPROM_STAT_ADD(a, field, n)    ((a)->stats.field += (n))
+#else
+#define EEPROM_STAT_ADD(a, field, n)    ((void) 0)
+#endif
+
 /**
  * @brief  This creates a new EEPROM instance
  * @note   The address of the instance must be passed in a function call
@@ -60,349 +210,2111 @@
 typedef struct eeprom {
     uint8_t eeprom_address;                 // Device Address
     uint16_t eeprom_size;                   // Size of EEPROM in Kbits
+    eeprom_geometry geometry;               // Derived from eeprom_size by eeprom_init()
+    uint16_t write_time;                    // tWR in ticks of eeprom_tick, 0 to ACK-poll instead
+    uint16_t write_start;                   // Tick at which the last write cycle started
+    uint8_t write_pending;                  // A write cycle may still be running
+    uint8_t bitrate;                        // TWBR for the bus speed of this EEPROM
+    uint8_t prescaler;                      // TWPS bits, EEPROM_CLOCK_KEEP to leave the clock alone
+    uint16_t poll_limit;                    // ACK-poll attempts before EEPROM_TIMEOUT, 0 for no limit
+    uint16_t sleep_time;                    // tWR in us to sleep through, 0 to stay awake
+#ifdef EEPROM_STATS
+    eeprom_stats stats;
+#endif
+#if EEPROM_CACHE_PAGES > 0
+    eeprom_cache_line cache[EEPROM_CACHE_PAGES];
+    uint8_t cache_valid;                    // Bit n set if cache[n] holds a line
+    uint8_t cache_dirty;                    // Bit n set if cache[n] has to be written back
+    uint8_t cache_next;                     // Next line to evict
+    uint16_t flush_delay;                   // Ticks a line stays dirty before eeprom_service() writes it
+#endif
+#if EEPROM_READAHEAD > 0
+    uint8_t ahead[EEPROM_READAHEAD];
+    uint32_t ahead_base;                    // Address of ahead[0]
+    uint8_t ahead_fill;                     // Bytes of ahead that hold chip data, 0 when empty
+    uint32_t ahead_next;                    // Address after the last read, where a run would go on
+#endif
 }eeprom;
 
+/**
+ * @brief  Tick source used to time write cycles
+ * @note   Any free running counter will do, the unit is up to the application.
+ */
+typedef uint16_t (*eeprom_tick_fn)(void);
+
+static eeprom_tick_fn eeprom_tick;
+
+/**
+ * @brief  Sleep hook used to wait out write cycles
+ * @note   Should sleep for about us microseconds, returning early on a wakeup is fine.
+ */
+typedef void (*eeprom_sleep_fn)(uint16_t us);
+
+static eeprom_sleep_fn eeprom_sleep;
+
+// The TWI is set up once for all instances, and its clock is only reprogrammed
+// when an access goes to a device with a different speed from the previous one.
+#define EEPROM_CLOCK_KEEP               0xFF
+#if EEPROM_BUS == EEPROM_BUS_TWI && defined(TWBR) && defined(F_CPU)
+#define EEPROM_CLOCK_CONTROL            1
+#else
+#define EEPROM_CLOCK_CONTROL            0   // no TWI registers to program, or another backend
+#endif
+
+static uint8_t eeprom_bus_started;
+
+// Set from the START to the STOP of every transaction, so that eeprom_service() run from
+// an interrupt can tell the foreground is in the middle of one.
+static volatile uint8_t eeprom_bus_claimed;
+static volatile uint8_t eeprom_bus_users;                                           // Claims of the application, see eeprom_bus_claim()
+
+/**
+ * @brief  i2c_start() that marks the bus as taken
+ * @param  address: I2C address with the RW bit
+ * @return 0 if the device ACKed, 1 if not
+ */
+static inline unsigned char eeprom_start(unsigned char address) {
+    eeprom_bus_claimed = 1;
+    return i2c_start(address);
+}
+
+/**
+ * @brief  i2c_stop() that marks the bus as free
+ * @return None
+ */
+static inline void eeprom_stop(void) {
+    i2c_stop();
+    eeprom_bus_claimed = 0;
+}
+
+/**
+ * @brief  To mark the bus as taken by the application
+ * @note   eeprom_service() only sees the transfers of this library. Code that talks to
+ *         other devices on the bus with raw i2cmaster calls, an RTC or a sensor, has to
+ *         claim the bus around them when eeprom_service() runs from an interrupt.
+ *         Claims nest, each one needs an eeprom_bus_release(), and must not be made from
+ *         the interrupt itself.
+ * @return None
+ */
+static inline void eeprom_bus_claim(void) {
+    ++eeprom_bus_users;
+}
+
+/**
+ * @brief  To give back a claim made with eeprom_bus_claim()
+ * @return None
+ */
+static inline void eeprom_bus_release(void) {
+    --eeprom_bus_users;
+}
+
+#if EEPROM_CLOCK_CONTROL
+static uint8_t eeprom_bus_bitrate;
+static uint8_t eeprom_bus_prescaler = EEPROM_CLOCK_KEEP;
+static uint8_t eeprom_default_bitrate;                                              // Clock left by i2c_init(), for instances without a speed
+static uint8_t eeprom_default_prescaler;
+#endif
+
+/**
+ * @brief  Work out TWBR and the prescaler for a bus speed
+ * @note   SCL = F_CPU / (16 + 2 * TWBR * 4^TWPS). Speeds above F_CPU / 16 get the
+ *         fastest clock the part can make.
+ * @param  *a: Address of the EEPROM instance
+ * @param  speed_khz: Bus speed in kHz, 0 to keep the clock set by i2c_init()
+ * @return None
+ */
+static void eeprom_clock_setup(eeprom *a, uint16_t speed_khz) {
+    a->bitrate = 0;
+    a->prescaler = EEPROM_CLOCK_KEEP;
+#if EEPROM_CLOCK_CONTROL
+    if (speed_khz != 0) {
+        uint32_t divider = F_CPU / ((uint32_t) speed_khz * 1000UL);
+        uint32_t twbr = (divider > 16) ? (divider - 16) / 2 : 0;
+        uint8_t prescaler = 0;
+
+        while (twbr > 255 && prescaler < 3) {
+            twbr /= 4;
+            ++prescaler;
+        }
+        a->bitrate = (twbr > 255) ? 255 : (uint8_t) twbr;
+        a->prescaler = prescaler;
+    }
+#else
+    (void) speed_khz;
+#endif
+}
+
+/**
+ * @brief  Switch the bus to the speed of this EEPROM if it is not running at it
+ * @note   An instance without a speed of its own gets the clock i2c_init() set up back.
+ * @param  *a: Address of the EEPROM instance
+ * @return None
+ */
+static void eeprom_clock_select(eeprom *a) {
+#if EEPROM_CLOCK_CONTROL
+    uint8_t bitrate = a->bitrate;
+    uint8_t prescaler = a->prescaler;
+
+    if (prescaler == EEPROM_CLOCK_KEEP) {
+        bitrate = eeprom_default_bitrate;
+        prescaler = eeprom_default_prescaler;
+    }
+    if (bitrate != eeprom_bus_bitrate || prescaler != eeprom_bus_prescaler) {
+        TWSR = prescaler;
+        TWBR = bitrate;
+        eeprom_bus_bitrate = bitrate;
+        eeprom_bus_prescaler = prescaler;
+    }
+#else
+    (void) a;
+#endif
+}
+
+#ifdef EEPROM_STATS
+/**
+ * @brief  To clear the access counters
+ * @param  *a: Address of the EEPROM instance
+ * @return None
+ */
+void eeprom_stats_reset(eeprom *a) {
+    a->stats.bytes_read = 0;
+    a->stats.bytes_written = 0;
+    a->stats.page_writes = 0;
+    a->stats.starts = 0;
+    a->stats.ack_polls = 0;
+    a->stats.wait_ticks = 0;
+}
+
+/**
+ * @brief  To take a copy of the access counters
+ * @param  *a: Address of the EEPROM instance
+ * @param  *snapshot: Where to copy the counters
+ * @return None
+ */
+void eeprom_stats_get(eeprom *a, eeprom_stats *snapshot) {
+    *snapshot = a->stats;
+}
+#endif
+
+/**
+ * @brief  To set the EEPROM properties and its bus speed
+ * @note   This is used to set the I2C address, the size and the SCL frequency of the EEPROM,
+ *         e.g. 400 or 1000 kHz for parts that support Fast-mode or Fast-mode Plus.
+ *         The speed is set on the TWI only, the USI and bit-banged backends run at the
+ *         rate chosen by EEPROM_BUS_FAST.
+ * @param  *a: Address of the EEPROM instance
+ * @param  dev_address: I2C address of the EEPROM
+ * @param  size: Size of the EEPROM in Kbits
+ * @param  speed_khz: Bus speed in kHz, 0 to keep the speed set by i2c_init()
+ * @return None
+ */
+void eeprom_init_speed(eeprom *a, uint8_t dev_address, uint16_t size, uint16_t speed_khz) {
+    if (!eeprom_bus_started) {
+        i2c_init();                          // once, shared by all instances
+        eeprom_bus_started = 1;
+#if EEPROM_CLOCK_CONTROL
+        eeprom_default_bitrate = TWBR;       // what instances without a speed run at
+        eeprom_default_prescaler = TWSR & 0x03;
+        eeprom_bus_bitrate = eeprom_default_bitrate;
+        eeprom_bus_prescaler = eeprom_default_prescaler;
+#endif
+    }
+    a->eeprom_address = dev_address;         // Set the device address
+    a->eeprom_size = size;                   // Set the eeprom size (size in kbits)
+
+    a->geometry = eeprom_geometry_of(size);  // Work out the geometry once, the transfers never branch on the size
+    a->write_time = 0;                       // ACK-poll until eeprom_set_write_time() is called
+    a->write_pending = 0;
+    a->poll_limit = EEPROM_POLL_RETRIES;
+    a->sleep_time = 0;                       // stay awake until eeprom_set_sleep_time() is called
+    eeprom_clock_setup(a, speed_khz);
+#ifdef EEPROM_STATS
+    eeprom_stats_reset(a);
+#endif
+#if EEPROM_CACHE_PAGES > 0
+    a->cache_valid = 0;
+    a->cache_dirty = 0;
+    a->cache_next = 0;
+    a->flush_delay = 0;
+#endif
+#if EEPROM_READAHEAD > 0
+    a->ahead_fill = 0;
+    a->ahead_next = 0;
+#endif
+}
+
 /**
  * @brief  To set the EEPROM properties
  * @note   This is used to set the I2C address and the size of the EEPROM.
+ *         The bus runs at the speed set by i2c_init().
  * @param  *a: Address of the EEPROM instance
  * @param  dev_address: I2C address of the EEPROM
  * @param  size: Size of the EEPROM in Kbits
  * @return None
  */
 void eeprom_init(eeprom *a, uint8_t dev_address, uint16_t size) {
-    i2c_init();
-    a->eeprom_address = dev_address;         // Set the device address
-    a->eeprom_size = size;                   // Set the eeprom size (size in kbits)
+    eeprom_init_speed(a, dev_address, size, 0);
 }
 
 /**
- * @brief  To write a byte array of data
+ * @brief  To set the tick source used for write cycle timing
+ * @param  tick: Function returning a free running tick count, NULL to disable timing
+ * @return None
+ */
+void eeprom_set_tick(eeprom_tick_fn tick) {
+    eeprom_tick = tick;
+}
+
+/**
+ * @brief  To set the write cycle time of an EEPROM
+ * @note   With a tick source and a write time set, an access to a chip that was just
+ *         written waits only for the rest of its tWR and does not poll the bus meanwhile.
  * @param  *a: Address of the EEPROM instance
- * @param  mem_address: Starting address
- * @param  *data: Data Array
- * @param  datasize: Size of the data array
+ * @param  ticks: tWR from the datasheet in ticks of the tick source, 0 to ACK-poll
  * @return None
  */
-void eeprom_write(eeprom *a, uint32_t mem_address, uint8_t *data, uint16_t datasize) {
-    uint8_t i2caddress;
-    uint16_t pos_in_page;
-    uint16_t bytes_written = 0;
-    uint16_t pages_written = 0;
-    if (a->eeprom_size == 1 || a->eeprom_size == 2) {
-        pos_in_page = mem_address % 8;                                              // 8 byte page write
-        while (bytes_written < datasize) {
-            // fixed device address
-            i2c_start_wait(a->eeprom_address + I2C_WRITE);                          // set the device address
-            i2c_write((uint8_t) mem_address + (8 * pos_in_page));                   // set the write address (one byte address)
-
-            // write one page of data
-            for (uint8_t i = pos_in_page; (i < 8) && (bytes_written < datasize); ++i) {
-                i2c_write(*(data + bytes_written));
-                ++bytes_written;
-            }
+void eeprom_set_write_time(eeprom *a, uint16_t ticks) {
+    a->write_time = ticks;
+    a->write_pending = 0;
+}
 
-            // go to the next page and set the position in the page to 0
-            ++pages_written;
-            pos_in_page = 0;
-        }
-    } else if (a->eeprom_size == 4) {
-        pos_in_page = mem_address % 16;                                             // 16 byte page write
-        while (bytes_written < datasize) {
-            i2caddress = a->eeprom_address | ((uint8_t) ((mem_address >> 7) & 0x2));// set the device address from the MSB bits
-            i2c_start_wait(i2caddress + I2C_WRITE);                                 // set the device address
-            i2c_write(((uint8_t) mem_address) + (16 * pos_in_page));                // set the write address (one byte address)
-
-            // write one page of data
-            for (uint8_t i = pos_in_page; (i < 16) && (bytes_written < datasize); ++i) {
-                i2c_write(*(data + bytes_written));
-                ++bytes_written;
-            }
+/**
+ * @brief  To bound the ACK polling of an EEPROM
+ * @note   A transfer to a device that does not answer within the budget stops with
+ *         EEPROM_TIMEOUT instead of polling forever.
+ * @param  *a: Address of the EEPROM instance
+ * @param  retries: ACK-poll attempts, 0 to poll until the device answers
+ * @return None
+ */
+void eeprom_set_timeout(eeprom *a, uint16_t retries) {
+    a->poll_limit = retries;
+}
 
-            // go to the next page and set the position in the page to 0
-            ++pages_written;
-            pos_in_page = 0;
-        }       
-    } else if (a->eeprom_size == 8) {
-        pos_in_page = mem_address % 16;                                             // 16 byte page write
-        while (bytes_written < datasize) {
-            i2caddress = a->eeprom_address | ((uint8_t) ((mem_address >> 7) & 0x6));// set the device address from the MSB bits
-            i2c_start_wait(i2caddress + I2C_WRITE);                                 // set the device address
-            i2c_write(((uint8_t) mem_address) + (16 * pos_in_page));                // set the write address (one byte address)
-
-            // write one page of data
-            for (uint8_t i = pos_in_page; (i < 16) && (bytes_written < datasize); ++i) {
-                i2c_write(*(data + bytes_written));
-                ++bytes_written;
-            }
+/**
+ * @brief  To set the sleep hook used during write cycles
+ * @note   eeprom_sleep_timer2() can be used on AVR, see EEPROM_SLEEP_TIMER2.
+ * @param  sleep: Function sleeping for a number of microseconds, NULL to stay awake
+ * @return None
+ */
+void eeprom_set_sleep(eeprom_sleep_fn sleep) {
+    eeprom_sleep = sleep;
+}
 
-            // go to the next page and set the position in the page to 0
-            ++pages_written;
-            pos_in_page = 0;
-        } 
-    } else if (a->eeprom_size == 16) {
-        pos_in_page = mem_address % 16;                                             // 16 byte page write
-        while (bytes_written < datasize) {
-            i2caddress = a->eeprom_address | ((uint8_t) ((mem_address >> 7) & 0xE));// set the device address from the MSB bits
-            i2c_start_wait(i2caddress + I2C_WRITE);                                 // set the device address
-            i2c_write(((uint8_t) mem_address) + (16 * pos_in_page));                // set the write address (one byte address)
-
-            // write one page of data
-            for (uint8_t i = pos_in_page; (i < 16) && (bytes_written < datasize); ++i) {
-                i2c_write(*(data + bytes_written));
-                ++bytes_written;
-            }
+/**
+ * @brief  To sleep through the write cycles of an EEPROM
+ * @note   When an access finds the chip still in its write cycle, the sleep hook is called
+ *         once instead of spinning, then the access goes on as usual. It sleeps for the
+ *         whole tWR, or with eeprom_set_write_time() for the part of it still to run.
+ *         A single page write still returns right after its STOP, call eeprom_wait()
+ *         to sleep until it is committed.
+ * @param  *a: Address of the EEPROM instance
+ * @param  us: tWR from the datasheet in microseconds, 0 to stay awake
+ * @return None
+ */
+void eeprom_set_sleep_time(eeprom *a, uint16_t us) {
+    a->sleep_time = us;
+}
 
-            // go to the next page and set the position in the page to 0
-            ++pages_written;
-            pos_in_page = 0;
-        } 
-    } else if (a->eeprom_size == 32 || a->eeprom_size == 64) {
-        // fixed device address
-        pos_in_page = mem_address % 32;                                             // 32 byte page write
-        while (bytes_written < datasize) {
-            // fixed device address
-            i2c_start_wait(a->eeprom_address + I2C_WRITE);                          // set the device address
-            i2c_write((uint8_t) ((mem_address & 0xFF00) >> 8));                     // write the MSB address first
-            i2c_write((uint8_t) ((mem_address & 0x00FF) + (32 * pos_in_page)));     // write the LSB address next
-
-            // write one page of data
-            for (uint8_t i = pos_in_page; (i < 32) && (bytes_written < datasize); ++i) {
-                i2c_write(*(data + bytes_written));
-                ++bytes_written;
-            }
+#ifdef EEPROM_SLEEP_TIMER2
+#ifndef F_CPU
+#error "EEPROM_SLEEP_TIMER2 needs F_CPU"
+#endif
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
 
-            // go to the next page and set the position in the page to 0
-            ++pages_written;
-            pos_in_page = 0;
-        }
-    } else if (a->eeprom_size == 128 || a->eeprom_size == 256) {
-        // fixed device address
-        pos_in_page = mem_address % 64;                                             // 64 byte page write
-        while (bytes_written < datasize) {
-            // fixed device address
-            i2c_start_wait(a->eeprom_address + I2C_WRITE);                          // set the device address
-            i2c_write((uint8_t) ((mem_address & 0xFF00) >> 8));                     // write the MSB address first
-            i2c_write((uint8_t) ((mem_address & 0x00FF) + (64 * pos_in_page)));     // write the LSB address next
-
-            // write one page of data
-            for (uint8_t i = pos_in_page; (i < 64) && (bytes_written < datasize); ++i) {
-                i2c_write(*(data + bytes_written));
-                ++bytes_written;
-            }
+// Sleep mode entered by eeprom_sleep_timer2(). Timer2 runs from the I/O clock, so the
+// default is idle, a deeper mode only works where Timer2 keeps running in it.
+#ifndef EEPROM_SLEEP_MODE
+#define EEPROM_SLEEP_MODE               SLEEP_MODE_IDLE
+#endif
 
-            // go to the next page and set the position in the page to 0
-            ++pages_written;
-            pos_in_page = 0;
-        }
-    } else if (a->eeprom_size == 512) {
-        // fixed device address
-        pos_in_page = mem_address % 128;                                            // 128 byte page write
-        while (bytes_written < datasize) {
-            // fixed device address
-            i2c_start_wait(a->eeprom_address + I2C_WRITE);                          // set the device address
-            i2c_write((uint8_t) ((mem_address & 0xFF00) >> 8));                     // write the MSB address first
-            i2c_write((uint8_t) ((mem_address & 0x00FF) + (128 * pos_in_page)));    // write the LSB address next
-
-            // write one page of data
-            for (uint8_t i = pos_in_page; (i < 128) && (bytes_written < datasize); ++i) {
-                i2c_write(*(data + bytes_written));
-                ++bytes_written;
-            }
+static volatile uint8_t eeprom_sleep_elapsed;
 
-            // go to the next page and set the position in the page to 0
-            ++pages_written;
-            pos_in_page = 0;
-        }
-    } else if (a->eeprom_size == 1024) {
-        // fixed device address
-        pos_in_page = mem_address % 256;                                            // 256 byte page write
-        while (bytes_written < datasize) {
-            // fixed device address
-            i2c_start_wait(a->eeprom_address + I2C_WRITE);
-            i2c_write((uint8_t) ((mem_address & 0xFF00) >> 8));                     // write the MSB address first
-            i2c_write((uint8_t) ((mem_address & 0x00FF) + (256 * pos_in_page)));    // write the LSB address next
-
-            // write one page of data
-            for (uint16_t i = pos_in_page; (i < 256) && (bytes_written < datasize); ++i) {
-                i2c_write(*(data + bytes_written));
-                ++bytes_written;
-            }
+ISR(TIMER2_COMPA_vect) {
+    eeprom_sleep_elapsed = 1;
+}
+
+/**
+ * @brief  Sleep hook on Timer2 of ATmega parts
+ * @note   Define EEPROM_SLEEP_TIMER2 before including this file to get it, the library then
+ *         owns Timer2 and its compare A interrupt. Counts at F_CPU / 1024 in CTC mode and
+ *         wakes on each compare match, other interrupts go on being served meanwhile.
+ *         Returns at once if interrupts are disabled, leaving the wait to ACK polling.
+ * @param  us: Time to sleep in microseconds
+ * @return None
+ */
+void eeprom_sleep_timer2(uint16_t us) {
+    uint32_t counts = ((uint32_t) us * (F_CPU / 1000UL) / 1000UL + 1023) / 1024;
+    uint8_t sreg = SREG;
+    uint8_t chunk;
 
-            // go to the next page and set the position in the page to 0
-            ++pages_written;
-            pos_in_page = 0;
+    if (!(sreg & (1 << SREG_I))) {
+        return;                                                                     // nothing would wake us up
+    }
+    set_sleep_mode(EEPROM_SLEEP_MODE);
+    TCCR2A = (1 << WGM21);
+    TIMSK2 |= (1 << OCIE2A);
+    while (counts > 0) {
+        chunk = (counts > 256) ? 0 : (uint8_t) counts;                              // 0 stands for 256 counts
+        counts -= (counts > 256) ? 256 : counts;
+        cli();
+        eeprom_sleep_elapsed = 0;
+        TCNT2 = 0;
+        OCR2A = (uint8_t) (chunk - 1);
+        TIFR2 = (1 << OCF2A);
+        TCCR2B = (1 << CS22) | (1 << CS21) | (1 << CS20);
+        while (!eeprom_sleep_elapsed) {
+            sleep_enable();
+            sei();                                                                  // takes effect after sleep_cpu(), no wakeup is lost
+            sleep_cpu();
+            sleep_disable();
+            cli();
         }
+        TCCR2B = 0;
     }
-    i2c_stop();
+    TIMSK2 &= ~(1 << OCIE2A);
+    SREG = sreg;
 }
+#endif
 
 /**
- * @brief  To read a byte array
+ * @brief  To check if the EEPROM has finished its write cycle
+ * @note   This does not touch the bus when write cycle timing is set up,
+ *         otherwise the device is probed with a START.
+ * @param  *a: Address of the EEPROM instance
+ * @return 1 if the EEPROM can be accessed, 0 if it is still busy
+ */
+uint8_t eeprom_is_ready(eeprom *a) {
+    uint8_t nack;
+
+    if (a->write_time != 0 && eeprom_tick) {
+        if (a->write_pending && (uint16_t) (eeprom_tick() - a->write_start) < a->write_time) {
+            return 0;
+        }
+        a->write_pending = 0;
+        return 1;
+    }
+    eeprom_clock_select(a);
+    EEPROM_STAT_ADD(a, starts, 1);
+    nack = eeprom_start(a->eeprom_address + I2C_WRITE);
+    eeprom_stop();
+    return !nack;
+}
+
+/**
+ * @brief  Sleep through the write cycle of this EEPROM if it is still running
+ * @note   Checks first so that a cycle that already ended costs no sleep. With a tick
+ *         source and a write time only the rest of the cycle is slept, scaled from
+ *         ticks to microseconds by the ratio of sleep_time to write_time.
  * @param  *a: Address of the EEPROM instance
- * @param  mem_address: Starting address
- * @param  *data: Data Array
- * @param  datasize: Size of the data array
  * @return None
  */
-void eeprom_read(eeprom *a, uint16_t mem_address, uint8_t *data, uint16_t datasize) {
-    uint8_t i2caddress;
-    uint16_t bytes_read = 0;
-
-    if (a->eeprom_size == 1 || a->eeprom_size == 2) {
-        i2c_start_wait(a->eeprom_address + I2C_WRITE);
-        i2c_write((uint8_t) mem_address);
-        i2c_stop();
-        i2c_start_wait(a->eeprom_address + I2C_READ);
-
-        while(bytes_read < datasize - 1) {
-            *(data + bytes_read) = i2c_readAck();                                   // Read datasize - 1 bytes
-            ++bytes_read;
-        }
-        *(data + bytes_read) = i2c_readNak();                                       // Read the last byte
-    } else if (a->eeprom_size == 4) {
-        i2caddress = a->eeprom_address | ((uint8_t) ((mem_address >> 7) & 0x2));
-        i2c_start_wait(i2caddress + I2C_WRITE);
-        i2c_write((uint8_t) mem_address);
-        i2c_stop();
-        i2c_start_wait(i2caddress + I2C_READ);
-
-        while(bytes_read < datasize - 1) {
-            *(data + bytes_read) = i2c_readAck();                                   // Read datasize - 1 bytes
-            ++bytes_read;
-        }
-        *(data + bytes_read) = i2c_readNak();                                       // Read the last byte
-    } else if (a->eeprom_size == 8) {
-        i2caddress = a->eeprom_address | ((uint8_t) ((mem_address >> 7) & 0x6));
-        i2c_start_wait(i2caddress + I2C_WRITE);
-        i2c_write((uint8_t) mem_address);
-        i2c_stop();
-        i2c_start_wait(i2caddress + I2C_READ);
-
-        while(bytes_read < datasize - 1) {
-            *(data + bytes_read) = i2c_readAck();                                   // Read datasize - 1 bytes
-            ++bytes_read;
-        }
-        *(data + bytes_read) = i2c_readNak();                                       // Read the last byte
-    } else if (a->eeprom_size == 16) {
-        i2caddress = a->eeprom_address | ((uint8_t) ((mem_address >> 7) & 0xE));
-        i2c_start_wait(i2caddress + I2C_WRITE);
-        i2c_write((uint8_t) mem_address);
-        i2c_stop();
-        i2c_start_wait(i2caddress + I2C_READ);
-
-        while(bytes_read < datasize - 1) {
-            *(data + bytes_read) = i2c_readAck();                                   // Read datasize - 1 bytes
-            ++bytes_read;
-        }
-        *(data + bytes_read) = i2c_readNak();                                       // Read the last byte
-    } else if (a->eeprom_size == 32 || a->eeprom_size == 64 || a->eeprom_size == 128 || a->eeprom_size == 256 || a->eeprom_size == 512 || a->eeprom_size == 1024) {
-        i2c_start_wait(a->eeprom_address + I2C_WRITE);
-        i2c_write((uint8_t) ((mem_address & 0xFF00) >> 8));                         // Write MSB address first
-        i2c_write((uint8_t) (mem_address & 0x00FF));                                // Write LSB address
-        i2c_stop();
-        i2c_start_wait(a->eeprom_address + I2C_READ);
-
-        while(bytes_read < datasize - 1) {
-            *(data + bytes_read) = i2c_readAck();                                   // Read datasize - 1 bytes
-            ++bytes_read;
-        }
-        *(data + bytes_read) = i2c_readNak();                                       // Read the last byte
+static void eeprom_sleep_ready(eeprom *a) {
+    uint16_t us = a->sleep_time;
+    uint16_t left;
+
+    if (!a->write_pending || us == 0 || !eeprom_sleep || eeprom_is_ready(a)) {
+        return;
     }
-    i2c_stop();
+    if (a->write_time != 0 && eeprom_tick) {
+        left = a->write_time - (uint16_t) (eeprom_tick() - a->write_start);        // eeprom_is_ready() saw it below write_time
+        us = (uint16_t) (((uint32_t) us * left + a->write_time - 1) / a->write_time);
+    }
+    eeprom_sleep(us);
 }
 
 /**
- * @brief  To write a byte
+ * @brief  Wait for the rest of the write cycle of this EEPROM
  * @param  *a: Address of the EEPROM instance
- * @param  mem_address: Address for the byte to be stored
- * @param  data: Byte data
  * @return None
  */
-void eeprom_byte_write(eeprom *a, uint16_t mem_address, uint8_t data) {
-    uint8_t i2caddress;
-
-    if (a->eeprom_size == 1 || a->eeprom_size == 2) {
-        // fixed device address
-        i2c_start_wait(a->eeprom_address + I2C_WRITE);                              // Set the device address
-        i2c_write((uint8_t) mem_address);                                           // Write the location to store the byte
-        i2c_write(data);                                                            // Write the data
-    } else if (a->eeprom_size == 4) {
-        i2caddress = a->eeprom_address | ((uint8_t) ((mem_address >> 7) & 0x2));
-        i2c_start_wait(i2caddress + I2C_WRITE);
-        i2c_write((uint8_t) mem_address);
-        i2c_write(data);
-    } else if (a->eeprom_size == 8) {
-        i2caddress = a->eeprom_address | ((uint8_t) ((mem_address >> 7) & 0x6));
-        i2c_start_wait(i2caddress + I2C_WRITE);
-        i2c_write((uint8_t) mem_address);
-        i2c_write(data);
-    } else if (a->eeprom_size == 16) {
-        i2caddress = a->eeprom_address | ((uint8_t) ((mem_address >> 7) & 0xE));
-        i2c_start_wait(i2caddress + I2C_WRITE);
-        i2c_write((uint8_t) mem_address);
-        i2c_write(data);
-    } else if (a->eeprom_size == 32 || a->eeprom_size == 64 || a->eeprom_size == 128 || a->eeprom_size == 256 || a->eeprom_size == 512 || a->eeprom_size == 1024) {
-        // fixed device address
-        i2c_start_wait(a->eeprom_address + I2C_WRITE);                              // Set the device address
-        i2c_write((uint8_t) ((mem_address & 0xFF00) >> 8));                         // Write the MSB address first
-        i2c_write((uint8_t) (mem_address & 0x00FF));                                // Write the LSB address next
-        i2c_write(data);                                                            // Write the data
+static void eeprom_wait_ready(eeprom *a) {
+    if (a->write_pending && a->write_time != 0 && eeprom_tick) {
+        uint16_t now;
+        while ((uint16_t) ((now = eeprom_tick()) - a->write_start) < a->write_time);
+        EEPROM_STAT_ADD(a, wait_ticks, (uint16_t) (now - a->write_start));
     }
-    i2c_stop();
+    a->write_pending = 0;
 }
 
 /**
- * @brief  To read a byte
+ * @brief  START and address the device, polling while it is in a write cycle
+ * @note   Same as i2c_start_wait(), but gives up after the poll budget of the instance.
+ * @param  *a: Address of the EEPROM instance
+ * @param  address: I2C address with the RW bit
+ * @return EEPROM_OK once the device has ACKed, EEPROM_TIMEOUT if it never did
+ */
+static eeprom_status eeprom_start_wait(eeprom *a, uint8_t address) {
+    uint16_t retries = a->poll_limit;
+#ifdef EEPROM_STATS
+    uint16_t since = eeprom_tick ? eeprom_tick() : 0;
+    uint32_t polls = a->stats.ack_polls;
+#endif
+
+    EEPROM_STAT_ADD(a, starts, 1);
+    while (eeprom_start(address)) {
+        eeprom_stop();                                                                 // device busy, try again
+        EEPROM_STAT_ADD(a, ack_polls, 1);                                              // every NACK counts, the last one too
+        if (retries != 0 && --retries == 0) {
+            return EEPROM_TIMEOUT;
+        }
+        EEPROM_STAT_ADD(a, starts, 1);
+    }
+#ifdef EEPROM_STATS
+    if (eeprom_tick && a->stats.ack_polls != polls) {                               // only a NACKed start was a wait
+        EEPROM_STAT_ADD(a, wait_ticks, (uint16_t) (eeprom_tick() - since));
+    }
+#endif
+    return EEPROM_OK;
+}
+
+/**
+ * @brief  Note the start of a write cycle
+ * @note   Call right after the STOP that ends a page write.
  * @param  *a: Address of the EEPROM instance
- * @param  mem_address: Location of the byte in EEPROM
- * @param  *data: Address of the data byte
  * @return None
  */
-void eeprom_byte_read(eeprom *a, uint16_t mem_address, uint8_t *data) {
-    uint8_t i2caddress;
-
-    if (a->eeprom_size == 1 || a->eeprom_size == 2) {
-        // fixed device address
-        i2c_start_wait(a->eeprom_address + I2C_WRITE);
-        i2c_write((uint8_t) mem_address);
-        i2c_stop();
-
-        i2c_start_wait(a->eeprom_address + I2C_READ);
-        *data = i2c_readNak();
-    } else if (a->eeprom_size == 4) {
-        i2caddress = a->eeprom_address | ((uint8_t) ((mem_address >> 7) & 0x2));
-        i2c_start_wait(i2caddress + I2C_WRITE);
-        i2c_write((uint8_t) mem_address);
-        i2c_stop();
-
-        i2c_start_wait(i2caddress + I2C_READ);
-        *data = i2c_readNak();
-    } else if (a->eeprom_size == 8) {
-        i2caddress = a->eeprom_address | ((uint8_t) ((mem_address >> 7) & 0x6));
-        i2c_start_wait(i2caddress + I2C_WRITE);
-        i2c_write((uint8_t) mem_address);
-        i2c_stop();
-
-        i2c_start_wait(i2caddress + I2C_READ);
-        *data = i2c_readNak();
-    } else if (a->eeprom_size == 16) {
-        i2caddress = a->eeprom_address | ((uint8_t) ((mem_address >> 7) & 0xE));
-        i2c_start_wait(i2caddress + I2C_WRITE);
-        i2c_write((uint8_t) mem_address);
-        i2c_stop();
-
-        i2c_start_wait(i2caddress + I2C_READ);
-        *data = i2c_readNak();
-    } else if (a->eeprom_size == 32 || a->eeprom_size == 64 || a->eeprom_size == 128 || a->eeprom_size == 256 || a->eeprom_size == 512 || a->eeprom_size == 1024) {
-        // fixed device address
-        i2c_start_wait(a->eeprom_address + I2C_WRITE);                              // Set the device address
-        i2c_write((uint8_t) ((mem_address & 0xFF00) >> 8));                         // Write the MSB address first
-        i2c_write((uint8_t) (mem_address & 0x00FF));                                // Write the LSB address next
-        i2c_stop();
-
-        i2c_start_wait(a->eeprom_address + I2C_READ);
-        *data = i2c_readNak();
+static void eeprom_cycle_started(eeprom *a) {
+    if (eeprom_tick) {
+        a->write_start = eeprom_tick();
     }
-    i2c_stop();
+    a->write_pending = 1;
+}
+
+/**
+ * @brief  To wait until the last write cycle of an EEPROM has ended
+ * @note   Sleeps through it when set up with eeprom_set_sleep_time(), for instance
+ *         before powering down. The write-back cache is not flushed.
+ * @param  *a: Address of the EEPROM instance
+ * @return EEPROM_OK once the device ACKs, EEPROM_TIMEOUT if it never did
+ */
+eeprom_status eeprom_wait(eeprom *a) {
+    eeprom_status status;
+
+    eeprom_sleep_ready(a);
+    eeprom_wait_ready(a);
+    eeprom_clock_select(a);
+    status = eeprom_start_wait(a, a->eeprom_address + I2C_WRITE);
+    if (status == EEPROM_OK) {
+        eeprom_stop();
+    }
+    return status;
+}
+
+/**
+ * @brief  Device address for a memory address
+ * @note   The block-select bits of the memory address are merged into the device address.
+ * @param  *a: Address of the EEPROM instance
+ * @param  g: Geometry of the EEPROM
+ * @param  mem_address: Memory address
+ * @return I2C address without the RW bit
+ */
+static EEPROM_ALWAYS_INLINE uint8_t eeprom_device_address(eeprom *a, eeprom_geometry g, uint32_t mem_address) {
+    return a->eeprom_address | ((uint8_t) (mem_address >> (8 * g.addr_bytes - 1)) & g.block_mask);
+}
+
+/**
+ * @brief  Number of bytes of a transfer that fit in the page of mem_address
+ * @param  g: Geometry of the EEPROM
+ * @param  mem_address: Current address
+ * @param  datasize: Bytes left in the transfer
+ * @return Bytes to write in this page
+ */
+static EEPROM_ALWAYS_INLINE uint16_t eeprom_page_chunk(eeprom_geometry g, uint32_t mem_address, uint16_t datasize) {
+    uint16_t chunk = g.page_size - (uint16_t) (mem_address & (g.page_size - 1));   // bytes left until the end of the page
+    return (chunk > datasize) ? datasize : chunk;
+}
+
+/**
+ * @brief  Address the device for a write and send the memory address
+ * @param  *a: Address of the EEPROM instance
+ * @param  g: Geometry of the EEPROM
+ * @param  mem_address: Memory address to set
+ * @return EEPROM_OK, EEPROM_TIMEOUT or EEPROM_NACK, the bus is released on failure
+ */
+static EEPROM_ALWAYS_INLINE eeprom_status eeprom_select(eeprom *a, eeprom_geometry g, uint32_t mem_address) {
+    eeprom_status status;
+
+    eeprom_sleep_ready(a);
+    eeprom_wait_ready(a);                                                           // only waits if this chip was just written
+    eeprom_clock_select(a);
+    status = eeprom_start_wait(a, eeprom_device_address(a, g, mem_address) + I2C_WRITE);   // set the device address
+    if (status != EEPROM_OK) {
+        return status;
+    }
+    if ((g.addr_bytes == 2 && i2c_write((uint8_t) (mem_address >> 8)))            // write the MSB address first
+        || i2c_write((uint8_t) mem_address)) {                                      // write the LSB address
+        eeprom_stop();
+        return EEPROM_NACK;
+    }
+    return EEPROM_OK;
+}
+
+/**
+ * @brief  Address the device for a read starting at mem_address
+ * @note   Sends the memory address, then turns the bus around with a repeated START,
+ *         so there is no STOP/START gap and no other master can take the bus meanwhile.
+ * @param  *a: Address of the EEPROM instance
+ * @param  g: Geometry of the EEPROM
+ * @param  mem_address: Memory address to read from
+ * @return EEPROM_OK, EEPROM_TIMEOUT or EEPROM_NACK, the bus is released on failure
+ */
+static EEPROM_ALWAYS_INLINE eeprom_status eeprom_select_read(eeprom *a, eeprom_geometry g, uint32_t mem_address) {
+    eeprom_status status = eeprom_select(a, g, mem_address);
+
+    if (status != EEPROM_OK) {
+        return status;
+    }
+    EEPROM_STAT_ADD(a, starts, 1);
+    if (i2c_rep_start(eeprom_device_address(a, g, mem_address) + I2C_READ)) {
+        eeprom_stop();
+        return EEPROM_NACK;
+    }
+    return EEPROM_OK;
+}
+
+// Where the page write loop takes its bytes from, and the read loop puts them
+#define EEPROM_SOURCE_RAM               0
+#define EEPROM_SOURCE_PGM               1   // program memory, read with pgm_read_byte()
+#define EEPROM_SOURCE_CALLBACK          2   // data points to an eeprom_callbacks
+#define EEPROM_SOURCE_FILL              3   // data points to one byte, sent for every address
+
+/**
+ * @brief  Producer of the bytes for eeprom_write_cb()
+ * @param  *context: Pointer given to eeprom_write_cb()
+ * @return Next byte to write
+ */
+typedef uint8_t (*eeprom_producer)(void *context);
+
+/**
+ * @brief  Consumer of the bytes of eeprom_read_cb()
+ * @param  *context: Pointer given to eeprom_read_cb()
+ * @param  data: Next byte read
+ * @return None
+ */
+typedef void (*eeprom_consumer)(void *context, uint8_t data);
+
+typedef struct eeprom_callbacks {
+    eeprom_producer producer;
+    eeprom_consumer consumer;
+    void *context;
+}eeprom_callbacks;
+
+// CRC kept by eeprom_write_crc() and eeprom_read_crc(), set EEPROM_CRC_BITS to 8 or 16.
+// CRC-8 uses polynomial 0x07, CRC-16 the CCITT polynomial 0x1021, both MSB first.
+#ifndef EEPROM_CRC_BITS
+#define EEPROM_CRC_BITS                 16
+#endif
+
+#if EEPROM_CRC_BITS == 8
+#define EEPROM_CRC_INIT                 0x00
+typedef uint8_t eeprom_crc;
+static const uint8_t eeprom_crc_table[16] PROGMEM = {
+    0x00, 0x07, 0x0E, 0x09, 0x1C, 0x1B, 0x12, 0x15, 0x38, 0x3F, 0x36, 0x31, 0x24, 0x23, 0x2A, 0x2D
+};
+#define EEPROM_CRC_NIBBLE(crc, n)       ((eeprom_crc) (((crc) << 4) ^ pgm_read_byte(&eeprom_crc_table[((crc) >> 4) ^ (n)])))
+#elif EEPROM_CRC_BITS == 16
+#define EEPROM_CRC_INIT                 0xFFFF
+typedef uint16_t eeprom_crc;
+static const uint16_t eeprom_crc_table[16] PROGMEM = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+    0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF
+};
+#define EEPROM_CRC_NIBBLE(crc, n)       ((eeprom_crc) (((crc) << 4) ^ pgm_read_word(&eeprom_crc_table[((crc) >> 12) ^ (n)])))
+#else
+#error "EEPROM_CRC_BITS must be 8 or 16"
+#endif
+
+/**
+ * @brief  Add a byte to a CRC
+ * @note   Works a nibble at a time from a 16 entry table in flash.
+ * @param  crc: CRC so far
+ * @param  data: Next byte
+ * @return Updated CRC
+ */
+static EEPROM_ALWAYS_INLINE eeprom_crc eeprom_crc_update(eeprom_crc crc, uint8_t data) {
+    crc = EEPROM_CRC_NIBBLE(crc, data >> 4);
+    return EEPROM_CRC_NIBBLE(crc, data & 0x0F);
+}
+
+#if EEPROM_READAHEAD > 0
+/**
+ * @brief  Forget the read-ahead buffer if a write overlaps it
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address of the write
+ * @param  datasize: Size of the write
+ * @return None
+ */
+static EEPROM_ALWAYS_INLINE void eeprom_ahead_drop(eeprom *a, uint32_t mem_address, uint16_t datasize) {
+    if (a->ahead_base < mem_address + datasize && a->ahead_base + a->ahead_fill > mem_address) {
+        a->ahead_fill = 0;
+    }
+}
+#endif
+
+/**
+ * @brief  Page write loop shared by all the write functions
+ * @note   source is a constant at every call site, so only one fetch is compiled in.
+ * @param  *a: Address of the EEPROM instance
+ * @param  g: Geometry of the EEPROM
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @param  source: EEPROM_SOURCE_RAM, EEPROM_SOURCE_PGM, EEPROM_SOURCE_CALLBACK or EEPROM_SOURCE_FILL
+ * @param  *crc: CRC updated with every byte sent, NULL for none
+ * @return EEPROM_OK, or the first failure, after which nothing more is sent
+ */
+static EEPROM_ALWAYS_INLINE eeprom_status eeprom_write_from(eeprom *a, eeprom_geometry g, uint32_t mem_address, const uint8_t *data, uint16_t datasize, uint8_t source, eeprom_crc *crc) {
+    const eeprom_callbacks *cb = (const eeprom_callbacks *) (const void *) data;
+    eeprom_status status;
+    uint16_t chunk;
+    uint8_t byte;
+
+    if (g.page_size == 0) {
+        return EEPROM_ERROR;                                                        // unsupported size
+    }
+#if EEPROM_READAHEAD > 0
+    eeprom_ahead_drop(a, mem_address, datasize);
+#endif
+    while (datasize > 0) {
+        chunk = eeprom_page_chunk(g, mem_address, datasize);
+        status = eeprom_select(a, g, mem_address);
+        if (status != EEPROM_OK) {
+            return status;
+        }
+
+        // write one page of data
+        for (uint16_t i = 0; i < chunk; ++i) {
+            if (source == EEPROM_SOURCE_CALLBACK) {
+                byte = cb->producer(cb->context);
+            } else if (source == EEPROM_SOURCE_FILL) {
+                byte = *data;
+            } else {
+                byte = (source == EEPROM_SOURCE_PGM) ? pgm_read_byte(data) : *data;
+                ++data;
+            }
+            if (i2c_write(byte)) {
+                eeprom_stop();                                                         // the bytes that were ACKed get written
+                eeprom_cycle_started(a);
+                return EEPROM_NACK;
+            }
+            if (crc) {
+                *crc = eeprom_crc_update(*crc, byte);
+            }
+        }
+        eeprom_stop();                                                                 // the write cycle starts on STOP
+        eeprom_cycle_started(a);
+        EEPROM_STAT_ADD(a, bytes_written, chunk);
+        EEPROM_STAT_ADD(a, page_writes, 1);
+
+        // go to the start of the next page
+        mem_address += chunk;
+        datasize -= chunk;
+    }
+    return EEPROM_OK;
+}
+
+/**
+ * @brief  Page write loop for data in RAM
+ * @param  *a: Address of the EEPROM instance
+ * @param  g: Geometry of the EEPROM
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @return Status of the transfer
+ */
+static EEPROM_ALWAYS_INLINE eeprom_status eeprom_write_geom(eeprom *a, eeprom_geometry g, uint32_t mem_address, const uint8_t *data, uint16_t datasize) {
+    return eeprom_write_from(a, g, mem_address, data, datasize, EEPROM_SOURCE_RAM, 0);
 }
+
+/**
+ * @brief  Write of an object, planned as at most two page writes when it fits in a page
+ * @note   An object no larger than a page touches one page or two. With the geometry, the
+ *         address and the size constant the split is worked out at compile time, and the
+ *         call becomes one or two fixed page writes with no loop. Larger objects take
+ *         the page loop.
+ * @param  *a: Address of the EEPROM instance
+ * @param  g: Geometry of the EEPROM
+ * @param  mem_address: Starting address
+ * @param  *value: Object to write
+ * @param  size: Size of the object
+ * @return Status of the transfer
+ */
+static EEPROM_ALWAYS_INLINE eeprom_status eeprom_put_geom(eeprom *a, eeprom_geometry g, uint32_t mem_address, const void *value, uint16_t size) {
+    const uint8_t *data = (const uint8_t *) value;
+    eeprom_status status;
+    uint16_t first;
+
+    if (g.page_size == 0 || size > g.page_size) {
+        return eeprom_write_geom(a, g, mem_address, data, size);
+    }
+    first = eeprom_page_chunk(g, mem_address, size);
+    status = eeprom_write_geom(a, g, mem_address, data, first);                    // ends at or before the page boundary
+    if (status != EEPROM_OK || first == size) {
+        return status;
+    }
+    return eeprom_write_geom(a, g, mem_address + first, data + first, size - first);
+}
+
+/**
+ * @brief  Sequential read shared by all the read functions
+ * @param  *a: Address of the EEPROM instance
+ * @param  g: Geometry of the EEPROM
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @param  sink: EEPROM_SOURCE_RAM or EEPROM_SOURCE_CALLBACK
+ * @param  *crc: CRC updated with every byte received, NULL for none
+ * @return Status of the transfer
+ */
+static EEPROM_ALWAYS_INLINE eeprom_status eeprom_read_to(eeprom *a, eeprom_geometry g, uint32_t mem_address, uint8_t *data, uint16_t datasize, uint8_t sink, eeprom_crc *crc) {
+    const eeprom_callbacks *cb = (const eeprom_callbacks *) (const void *) data;
+    eeprom_status status;
+    uint8_t byte;
+
+    if (g.page_size == 0) {
+        return EEPROM_ERROR;
+    }
+    if (datasize == 0) {
+        return EEPROM_OK;
+    }
+    status = eeprom_select_read(a, g, mem_address);
+    if (status != EEPROM_OK) {
+        return status;
+    }
+    EEPROM_STAT_ADD(a, bytes_read, datasize);
+
+    while (datasize > 0) {
+        byte = (datasize > 1) ? i2c_readAck() : i2c_readNak();                     // NAK the last byte
+        if (crc) {
+            *crc = eeprom_crc_update(*crc, byte);
+        }
+        if (sink == EEPROM_SOURCE_CALLBACK) {
+            cb->consumer(cb->context, byte);
+        } else {
+            *data++ = byte;
+        }
+        --datasize;
+    }
+    eeprom_stop();
+    return EEPROM_OK;
+}
+
+/**
+ * @brief  Sequential read into RAM
+ * @param  *a: Address of the EEPROM instance
+ * @param  g: Geometry of the EEPROM
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @return Status of the transfer
+ */
+static EEPROM_ALWAYS_INLINE eeprom_status eeprom_read_geom(eeprom *a, eeprom_geometry g, uint32_t mem_address, uint8_t *data, uint16_t datasize) {
+    return eeprom_read_to(a, g, mem_address, data, datasize, EEPROM_SOURCE_RAM, 0);
+}
+
+/**
+ * @brief  Page write using the geometry of the instance
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @return Status of the transfer
+ */
+static eeprom_status eeprom_write_raw(eeprom *a, uint32_t mem_address, const uint8_t *data, uint16_t datasize) {
+    return eeprom_write_geom(a, a->geometry, mem_address, data, datasize);
+}
+
+/**
+ * @brief  Sequential read using the geometry of the instance
+ * @note   Goes through the read-ahead buffer when it is enabled. Bytes already in it are
+ *         copied from RAM. A rest shorter than the buffer that carries on from the
+ *         previous read refills it from there, so a run of small reads at increasing
+ *         addresses costs one bus transfer per buffer.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @return Status of the transfer
+ */
+static eeprom_status eeprom_read_raw(eeprom *a, uint32_t mem_address, uint8_t *data, uint16_t datasize) {
+#if EEPROM_READAHEAD > 0
+    uint32_t limit = (uint32_t) a->eeprom_size * 128;
+    uint8_t run = (mem_address == a->ahead_next);
+    eeprom_status status;
+    uint16_t chunk;
+
+    a->ahead_next = mem_address + datasize;
+    if (mem_address >= a->ahead_base && mem_address < a->ahead_base + a->ahead_fill) {
+        chunk = (uint16_t) (a->ahead_base + a->ahead_fill - mem_address);
+        if (chunk > datasize) {
+            chunk = datasize;
+        }
+        memcpy(data, a->ahead + (mem_address - a->ahead_base), chunk);
+        mem_address += chunk;
+        data += chunk;
+        datasize -= chunk;
+        run = 1;
+    }
+    if (datasize == 0) {
+        return EEPROM_OK;
+    }
+    if (!run || datasize >= EEPROM_READAHEAD || mem_address + EEPROM_READAHEAD > limit) {
+        return eeprom_read_geom(a, a->geometry, mem_address, data, datasize);      // not a run, a long read or the end of the part
+    }
+    a->ahead_fill = 0;
+    status = eeprom_read_geom(a, a->geometry, mem_address, a->ahead, EEPROM_READAHEAD);
+    if (status != EEPROM_OK) {
+        return status;
+    }
+    a->ahead_base = mem_address;
+    a->ahead_fill = EEPROM_READAHEAD;
+    memcpy(data, a->ahead, datasize);
+    return EEPROM_OK;
+#else
+    return eeprom_read_geom(a, a->geometry, mem_address, data, datasize);
+#endif
+}
+
+/**
+ * @brief  Compare EEPROM contents with a byte array
+ * @note   A single sequential read that NAKs and stops right after the first difference.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @param  source: EEPROM_SOURCE_RAM, EEPROM_SOURCE_PGM or EEPROM_SOURCE_FILL
+ * @param  *match: Offset of the first difference, datasize if the EEPROM holds the data
+ * @return Status of the read, EEPROM_ERROR if the geometry is unknown, match is only set on EEPROM_OK
+ */
+static EEPROM_ALWAYS_INLINE eeprom_status eeprom_compare_from(eeprom *a, uint32_t mem_address, const uint8_t *data, uint16_t datasize, uint8_t source, uint16_t *match) {
+    uint16_t offset = 0;
+    uint8_t expected;
+    eeprom_status status;
+
+    if (a->geometry.page_size == 0) {
+        return EEPROM_ERROR;
+    }
+    if (datasize == 0) {
+        *match = 0;
+        return EEPROM_OK;
+    }
+    status = eeprom_select_read(a, a->geometry, mem_address);
+    if (status != EEPROM_OK) {
+        return status;
+    }
+
+    for (;;) {
+        expected = (source == EEPROM_SOURCE_FILL) ? *data
+                 : (source == EEPROM_SOURCE_PGM) ? pgm_read_byte(data + offset) : data[offset];
+        EEPROM_STAT_ADD(a, bytes_read, 1);
+        if (offset == datasize - 1) {
+            if (i2c_readNak() == expected) {
+                ++offset;
+            }
+            break;
+        }
+        if (i2c_readAck() != expected) {
+            i2c_readNak();                                                          // a NAK is needed to end the read
+            EEPROM_STAT_ADD(a, bytes_read, 1);
+            break;
+        }
+        ++offset;
+    }
+    eeprom_stop();
+    *match = offset;
+    return EEPROM_OK;
+}
+
+#if EEPROM_CACHE_PAGES > 0
+/**
+ * @brief  Size of a cache line for this EEPROM
+ * @note   Never more than a page, so a line is written back with one write cycle.
+ * @param  *a: Address of the EEPROM instance
+ * @return Line size in bytes
+ */
+static uint16_t eeprom_cache_line_size(eeprom *a) {
+    return (a->geometry.page_size < EEPROM_CACHE_PAGE_SIZE) ? a->geometry.page_size : EEPROM_CACHE_PAGE_SIZE;
+}
+
+/**
+ * @brief  Find the cache line holding an address
+ * @param  *a: Address of the EEPROM instance
+ * @param  base: Address of the first byte of the line
+ * @return Index of the line, -1 if it is not cached
+ */
+static int8_t eeprom_cache_find(eeprom *a, uint32_t base) {
+    for (uint8_t i = 0; i < EEPROM_CACHE_PAGES; ++i) {
+        if ((a->cache_valid & (1 << i)) && a->cache[i].base == base) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief  Copy data written to the chip into the cache lines that overlap it
+ * @note   Keeps resident lines in step with a write that bypassed the cache.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @return None
+ */
+static void eeprom_cache_refresh(eeprom *a, uint32_t mem_address, const uint8_t *data, uint16_t datasize) {
+    uint16_t line = eeprom_cache_line_size(a);
+
+    for (uint8_t i = 0; i < EEPROM_CACHE_PAGES; ++i) {
+        uint32_t base = a->cache[i].base;
+        if ((a->cache_valid & (1 << i)) && base < mem_address + datasize && base + line > mem_address) {
+            uint32_t from = (base > mem_address) ? base : mem_address;
+            uint32_t to = (base + line < mem_address + datasize) ? base + line : mem_address + datasize;
+            memcpy(a->cache[i].data + (from - base), data + (from - mem_address), (size_t) (to - from));
+        }
+    }
+}
+
+/**
+ * @brief  Write a cache line back if it is dirty
+ * @param  *a: Address of the EEPROM instance
+ * @param  i: Index of the line
+ * @return Status of the write back, the line stays dirty if it failed
+ */
+static eeprom_status eeprom_cache_clean(eeprom *a, uint8_t i) {
+    eeprom_status status = EEPROM_OK;
+
+    if (a->cache_dirty & (1 << i)) {
+        status = eeprom_write_raw(a, a->cache[i].base, a->cache[i].data, eeprom_cache_line_size(a));
+        if (status == EEPROM_OK) {
+            a->cache_dirty &= ~(1 << i);
+        }
+    }
+    return status;
+}
+
+/**
+ * @brief  Write back and forget the cache lines that overlap a range
+ * @note   Used before a write that cannot go through the cache.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  datasize: Size of the range
+ * @return Status of the write backs, lines that could not be written back are kept
+ */
+static eeprom_status eeprom_cache_drop(eeprom *a, uint32_t mem_address, uint16_t datasize) {
+    uint16_t line = eeprom_cache_line_size(a);
+    eeprom_status status;
+
+    for (uint8_t i = 0; i < EEPROM_CACHE_PAGES; ++i) {
+        uint32_t base = a->cache[i].base;
+        if ((a->cache_valid & (1 << i)) && base < mem_address + datasize && base + line > mem_address) {
+            status = eeprom_cache_clean(a, i);
+            if (status != EEPROM_OK) {
+                return status;
+            }
+            a->cache_valid &= ~(1 << i);
+        }
+    }
+    return EEPROM_OK;
+}
+
+/**
+ * @brief  Load a line into the cache
+ * @note   Takes a free line if there is one, otherwise evicts round robin.
+ * @param  *a: Address of the EEPROM instance
+ * @param  base: Address of the first byte of the line
+ * @return Index of the line, -1 if the evicted line or the new one failed
+ */
+static int8_t eeprom_cache_load(eeprom *a, uint32_t base) {
+    uint8_t i = 0;
+
+    while (i < EEPROM_CACHE_PAGES && (a->cache_valid & (1 << i))) {
+        ++i;
+    }
+    if (i == EEPROM_CACHE_PAGES) {
+        i = a->cache_next;
+        a->cache_next = (i + 1) % EEPROM_CACHE_PAGES;
+        if (eeprom_cache_clean(a, i) != EEPROM_OK) {
+            return -1;
+        }
+        a->cache_valid &= ~(1 << i);
+    }
+    if (eeprom_read_raw(a, base, a->cache[i].data, eeprom_cache_line_size(a)) != EEPROM_OK) {
+        return -1;
+    }
+    a->cache[i].base = base;
+    a->cache_valid |= (1 << i);
+    return i;
+}
+
+/**
+ * @brief  Write through the cache
+ * @note   Lines that are cached, or only partly covered, are updated in RAM.
+ *         Runs of whole lines that are not cached go straight to the EEPROM.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @return Status of the transfers that were needed
+ */
+static eeprom_status eeprom_cache_write(eeprom *a, uint32_t mem_address, const uint8_t *data, uint16_t datasize) {
+    uint16_t line = eeprom_cache_line_size(a);
+    uint32_t run_address = mem_address;
+    const uint8_t *run_data = data;
+    eeprom_status status;
+    uint16_t run = 0;
+
+    if (line == 0) {
+        return EEPROM_ERROR;
+    }
+    while (datasize > 0) {
+        uint16_t offset = (uint16_t) (mem_address & (line - 1));
+        uint16_t chunk = (line - offset > datasize) ? datasize : line - offset;
+        int8_t i = eeprom_cache_find(a, mem_address - offset);
+
+        if (i < 0 && chunk == line) {
+            run += chunk;                                                           // whole line, no point caching it
+        } else {
+            if (run > 0) {
+                status = eeprom_write_raw(a, run_address, run_data, run);
+                if (status != EEPROM_OK) {
+                    return status;
+                }
+                run = 0;
+            }
+            if (i < 0) {
+                i = eeprom_cache_load(a, mem_address - offset);
+                if (i < 0) {
+                    return EEPROM_ERROR;
+                }
+            }
+            memcpy(a->cache[i].data + offset, data, chunk);
+            if (!(a->cache_dirty & (1 << i)) && eeprom_tick) {
+                a->cache[i].dirty_since = eeprom_tick();
+            }
+            a->cache_dirty |= (1 << i);                                             // after the copy, so a write back in between is redone
+            run_address = mem_address + chunk;
+            run_data = data + chunk;
+        }
+        mem_address += chunk;
+        data += chunk;
+        datasize -= chunk;
+    }
+    return (run > 0) ? eeprom_write_raw(a, run_address, run_data, run) : EEPROM_OK;
+}
+
+/**
+ * @brief  Read through the cache
+ * @note   Cached lines are copied from RAM, the rest is read in as few transfers as possible.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @return Status of the transfers that were needed
+ */
+static eeprom_status eeprom_cache_read(eeprom *a, uint32_t mem_address, uint8_t *data, uint16_t datasize) {
+    uint16_t line = eeprom_cache_line_size(a);
+    uint32_t run_address = mem_address;
+    uint8_t *run_data = data;
+    eeprom_status status;
+    uint16_t run = 0;
+
+    if (line == 0) {
+        return EEPROM_ERROR;
+    }
+    while (datasize > 0) {
+        uint16_t offset = (uint16_t) (mem_address & (line - 1));
+        uint16_t chunk = (line - offset > datasize) ? datasize : line - offset;
+        int8_t i = eeprom_cache_find(a, mem_address - offset);
+
+        if (i < 0) {
+            run += chunk;
+        } else {
+            if (run > 0) {
+                status = eeprom_read_raw(a, run_address, run_data, run);
+                if (status != EEPROM_OK) {
+                    return status;
+                }
+                run = 0;
+            }
+            memcpy(data, a->cache[i].data + offset, chunk);
+            run_address = mem_address + chunk;
+            run_data = data + chunk;
+        }
+        mem_address += chunk;
+        data += chunk;
+        datasize -= chunk;
+    }
+    return (run > 0) ? eeprom_read_raw(a, run_address, run_data, run) : EEPROM_OK;
+}
+#endif
+
+/**
+ * @brief  Make a range safe for a transfer that goes past the write-back cache
+ * @note   Overlapping lines are written back and dropped, so the chip holds the latest
+ *         data and no cached copy is left to go stale. Does nothing without the cache.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  datasize: Size of the range
+ * @return Status of the write backs
+ */
+static inline eeprom_status eeprom_cache_bypass(eeprom *a, uint32_t mem_address, uint16_t datasize) {
+#if EEPROM_CACHE_PAGES > 0
+    return eeprom_cache_drop(a, mem_address, datasize);
+#else
+    (void) a;
+    (void) mem_address;
+    (void) datasize;
+    return EEPROM_OK;
+#endif
+}
+
+/**
+ * @brief  To write back everything held in the cache
+ * @note   Does nothing when EEPROM_CACHE_PAGES is 0.
+ * @param  *a: Address of the EEPROM instance
+ * @return EEPROM_OK, or the first failure, the lines not written back stay dirty
+ */
+eeprom_status eeprom_flush(eeprom *a) {
+#if EEPROM_CACHE_PAGES > 0
+    eeprom_status status;
+
+    for (uint8_t i = 0; i < EEPROM_CACHE_PAGES; ++i) {
+        status = eeprom_cache_clean(a, i);
+        if (status != EEPROM_OK) {
+            return status;
+        }
+    }
+#else
+    (void) a;
+#endif
+    return EEPROM_OK;
+}
+
+/**
+ * @brief  Page write straight to the chip, past the write-back cache
+ * @note   Cached lines that overlap the range are written back and dropped first, so the
+ *         data is on its way to the chip when this returns and no stale line is left.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @return Status of the transfers
+ */
+static inline eeprom_status eeprom_write_direct(eeprom *a, uint32_t mem_address, const uint8_t *data, uint16_t datasize) {
+    eeprom_status status = eeprom_cache_bypass(a, mem_address, datasize);
+
+    return (status == EEPROM_OK) ? eeprom_write_raw(a, mem_address, data, datasize) : status;
+}
+
+/**
+ * @brief  To hold back the background write of freshly dirtied cache lines
+ * @note   Needs a tick source. Writes to a line within the delay are merged into
+ *         one write cycle, a longer delay saves more cycles but keeps data in RAM longer.
+ *         Does nothing when EEPROM_CACHE_PAGES is 0.
+ * @param  *a: Address of the EEPROM instance
+ * @param  ticks: Time a line stays dirty before eeprom_service() writes it, 0 for none
+ * @return None
+ */
+void eeprom_set_flush_delay(eeprom *a, uint16_t ticks) {
+#if EEPROM_CACHE_PAGES > 0
+    a->flush_delay = ticks;
+#else
+    (void) a;
+    (void) ticks;
+#endif
+}
+
+/**
+ * @brief  To write back one dirty cache line, if that can be done without waiting
+ * @note   Meant for the idle loop or a timer interrupt. Writes the line dirty the longest
+ *         once it is older than the flush delay, and only when the chip is ready and no
+ *         other transfer holds the bus, so it never waits for a write cycle. From an
+ *         interrupt the call lasts one page write, the foreground may use the EEPROM
+ *         meanwhile. Only transfers of this library are seen, raw i2cmaster transfers
+ *         to other devices have to be wrapped in eeprom_bus_claim() and
+ *         eeprom_bus_release(). Does nothing when EEPROM_CACHE_PAGES is 0.
+ * @param  *a: Address of the EEPROM instance
+ * @return EEPROM_OK once no line is dirty, EEPROM_BUSY while some still are,
+ *         or the status of a failed write back
+ */
+eeprom_status eeprom_service(eeprom *a) {
+#if EEPROM_CACHE_PAGES > 0
+    uint16_t now = eeprom_tick ? eeprom_tick() : 0;
+    uint16_t age, oldest = 0;
+    eeprom_status status;
+    int8_t pick = -1;
+
+    if (!a->cache_dirty) {
+        return EEPROM_OK;
+    }
+    for (uint8_t i = 0; i < EEPROM_CACHE_PAGES; ++i) {
+        if (!(a->cache_dirty & (1 << i))) {
+            continue;
+        }
+        age = (uint16_t) (now - a->cache[i].dirty_since);
+        if ((!eeprom_tick || age >= a->flush_delay) && (pick < 0 || age > oldest)) {
+            pick = i;
+            oldest = age;
+        }
+    }
+    if (pick < 0 || eeprom_bus_claimed || eeprom_bus_users || !eeprom_is_ready(a)) {
+        return EEPROM_BUSY;                                                         // too fresh, bus taken or write cycle running
+    }
+    status = eeprom_cache_clean(a, pick);
+    if (status != EEPROM_OK) {
+        return status;
+    }
+    return a->cache_dirty ? EEPROM_BUSY : EEPROM_OK;
+#else
+    (void) a;
+    return EEPROM_OK;
+#endif
+}
+
+/**
+ * @brief  To write a byte array of data
+ * @note   With the cache enabled small writes are held in RAM until eeprom_flush() or eviction.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @return EEPROM_OK, EEPROM_ERROR for an unsupported size, EEPROM_TIMEOUT or EEPROM_NACK
+ */
+eeprom_status eeprom_write(eeprom *a, uint32_t mem_address, uint8_t *data, uint16_t datasize) {
+#if EEPROM_CACHE_PAGES > 0
+    return eeprom_cache_write(a, mem_address, data, datasize);
+#else
+    return eeprom_write_raw(a, mem_address, data, datasize);
+#endif
+}
+
+/**
+ * @brief  To read a byte array
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @return EEPROM_OK, EEPROM_ERROR for an unsupported size, EEPROM_TIMEOUT or EEPROM_NACK
+ */
+eeprom_status eeprom_read(eeprom *a, uint32_t mem_address, uint8_t *data, uint16_t datasize) {
+#if EEPROM_CACHE_PAGES > 0
+    return eeprom_cache_read(a, mem_address, data, datasize);
+#else
+    return eeprom_read_raw(a, mem_address, data, datasize);
+#endif
+}
+
+/**
+ * @brief  To write a byte
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Address for the byte to be stored
+ * @param  data: Byte data
+ * @return Status of the transfer
+ */
+eeprom_status eeprom_byte_write(eeprom *a, uint32_t mem_address, uint8_t data) {
+    return eeprom_write(a, mem_address, &data, 1);
+}
+
+/**
+ * @brief  To read a byte
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Location of the byte in EEPROM
+ * @param  *data: Address of the data byte
+ * @return Status of the transfer
+ */
+eeprom_status eeprom_byte_read(eeprom *a, uint32_t mem_address, uint8_t *data) {
+    return eeprom_read(a, mem_address, data, 1);
+}
+
+/**
+ * @brief  To write a byte array, skipping pages that already hold the data
+ * @note   Each page is read back first, which runs at bus speed with no write cycle,
+ *         and only pages that differ are written. Worth it for saves that rarely change.
+ *         The write-back cache is flushed first and cached lines are kept in step.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @return Status of the transfers
+ */
+eeprom_status eeprom_update(eeprom *a, uint32_t mem_address, uint8_t *data, uint16_t datasize) {
+    eeprom_status status;
+    uint16_t chunk, match;
+
+    if (a->geometry.page_size == 0) {
+        return EEPROM_ERROR;
+    }
+    status = eeprom_flush(a);                                                       // compare against what the chip will hold
+    while (datasize > 0 && status == EEPROM_OK) {
+        chunk = eeprom_page_chunk(a->geometry, mem_address, datasize);
+        status = eeprom_compare_from(a, mem_address, data, chunk, EEPROM_SOURCE_RAM, &match);
+        if (status == EEPROM_OK && match != chunk) {
+            status = eeprom_write_raw(a, mem_address, data, chunk);
+#if EEPROM_CACHE_PAGES > 0
+            if (status == EEPROM_OK) {
+                eeprom_cache_refresh(a, mem_address, data, chunk);
+            }
+#endif
+        }
+        mem_address += chunk;
+        data += chunk;
+        datasize -= chunk;
+    }
+    return status;
+}
+
+/**
+ * @brief  Page loop of the fill functions
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  value: Byte to store
+ * @param  datasize: Number of bytes to fill
+ * @param  skip: 1 to leave pages alone that already hold the value
+ * @return Status of the transfers
+ */
+static eeprom_status eeprom_fill_pages(eeprom *a, uint32_t mem_address, uint8_t value, uint32_t datasize, uint8_t skip) {
+    eeprom_status status = EEPROM_OK;
+    uint16_t chunk, match = 0;
+
+    if (a->geometry.page_size == 0) {
+        return EEPROM_ERROR;
+    }
+    if (skip) {
+        status = eeprom_flush(a);                                                   // compare against what the chip will hold
+    }
+    while (datasize > 0 && status == EEPROM_OK) {
+        chunk = eeprom_page_chunk(a->geometry, mem_address, (datasize > a->geometry.page_size) ? a->geometry.page_size : (uint16_t) datasize);
+        if (skip) {
+            status = eeprom_compare_from(a, mem_address, &value, chunk, EEPROM_SOURCE_FILL, &match);
+            if (status != EEPROM_OK) {
+                break;
+            }
+        }
+        if (!skip || match != chunk) {
+#if EEPROM_CACHE_PAGES > 0
+            status = eeprom_cache_drop(a, mem_address, chunk);
+            if (status != EEPROM_OK) {
+                break;
+            }
+#endif
+            status = eeprom_write_from(a, a->geometry, mem_address, &value, chunk, EEPROM_SOURCE_FILL, 0);
+        }
+        mem_address += chunk;
+        datasize -= chunk;
+    }
+    return status;
+}
+
+/**
+ * @brief  To set a range to one value
+ * @note   Every page of the range takes one page write, no buffer is needed.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  value: Byte to store
+ * @param  datasize: Number of bytes to fill, may cover the whole part
+ * @return Status of the transfers
+ */
+eeprom_status eeprom_fill(eeprom *a, uint32_t mem_address, uint8_t value, uint32_t datasize) {
+    return eeprom_fill_pages(a, mem_address, value, datasize, 0);
+}
+
+/**
+ * @brief  To set a range to one value, skipping pages that already hold it
+ * @note   Each page is read first and only written if a byte differs.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  value: Byte to store
+ * @param  datasize: Number of bytes to fill, may cover the whole part
+ * @return Status of the transfers
+ */
+eeprom_status eeprom_fill_update(eeprom *a, uint32_t mem_address, uint8_t value, uint32_t datasize) {
+    return eeprom_fill_pages(a, mem_address, value, datasize, 1);
+}
+
+/**
+ * @brief  To erase the whole EEPROM to 0xFF
+ * @note   Pages that are already erased cost a read but no write cycle.
+ * @param  *a: Address of the EEPROM instance
+ * @return Status of the transfers
+ */
+eeprom_status eeprom_erase(eeprom *a) {
+    return eeprom_fill_pages(a, 0, 0xFF, (uint32_t) a->eeprom_size * 128, 1);
+}
+
+// Bounce buffer of eeprom_copy(), on the stack. A buffer smaller than the destination
+// page size costs one write cycle per buffer instead of one per page.
+#ifndef EEPROM_COPY_BUFFER
+#define EEPROM_COPY_BUFFER              64
+#endif
+
+/**
+ * @brief  To copy a range within one EEPROM or from one EEPROM to another
+ * @note   The data goes through a small buffer split at the destination pages, so each
+ *         chunk is one page write. Writes return on the STOP, so with two chips the next
+ *         chunk is read from the source while the destination runs its write cycle.
+ *         Overlapping ranges on one EEPROM are copied as with memmove().
+ * @param  *src: Address of the source EEPROM instance
+ * @param  src_address: Starting address in the source
+ * @param  *dst: Address of the destination EEPROM instance
+ * @param  dst_address: Starting address in the destination
+ * @param  datasize: Number of bytes to copy
+ * @return EEPROM_OK, or the first failure, after which nothing more is copied
+ */
+eeprom_status eeprom_copy(eeprom *src, uint32_t src_address, eeprom *dst, uint32_t dst_address, uint32_t datasize) {
+    uint8_t buffer[EEPROM_COPY_BUFFER];
+    uint8_t backward = (src == dst && dst_address > src_address && dst_address < src_address + datasize);
+    uint16_t page_size = dst->geometry.page_size;
+    eeprom_status status;
+    uint32_t offset;
+    uint16_t chunk;
+
+    if (src->geometry.page_size == 0 || page_size == 0) {
+        return EEPROM_ERROR;
+    }
+    status = eeprom_flush(src);                                                     // read what the chip will hold
+    while (datasize > 0 && status == EEPROM_OK) {
+        if (backward) {
+            offset = dst_address + datasize - 1;                                    // last byte left, walk down from it
+            chunk = (uint16_t) (offset & (page_size - 1)) + 1;
+            if (chunk > datasize) {
+                chunk = (uint16_t) datasize;
+            }
+            if (chunk > EEPROM_COPY_BUFFER) {
+                chunk = EEPROM_COPY_BUFFER;
+            }
+            offset = datasize - chunk;
+        } else {
+            chunk = eeprom_page_chunk(dst->geometry, dst_address, (datasize > EEPROM_COPY_BUFFER) ? EEPROM_COPY_BUFFER : (uint16_t) datasize);
+            offset = 0;
+        }
+        status = eeprom_read_raw(src, src_address + offset, buffer, chunk);
+#if EEPROM_CACHE_PAGES > 0
+        if (status == EEPROM_OK) {
+            status = eeprom_cache_drop(dst, dst_address + offset, chunk);
+        }
+#endif
+        if (status == EEPROM_OK) {
+            status = eeprom_write_raw(dst, dst_address + offset, buffer, chunk);
+        }
+        if (!backward) {
+            src_address += chunk;
+            dst_address += chunk;
+        }
+        datasize -= chunk;
+    }
+    return status;
+}
+
+/**
+ * @brief  To write a byte array stored in program memory
+ * @note   Bytes are fetched with pgm_read_byte() inside the page loop, so no RAM copy
+ *         is needed. The data has to sit in the first 64KB of flash.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array in program memory
+ * @param  datasize: Size of the data array
+ * @return Status of the transfer
+ */
+eeprom_status eeprom_write_P(eeprom *a, uint32_t mem_address, const uint8_t *data, uint16_t datasize) {
+#if EEPROM_CACHE_PAGES > 0
+    eeprom_status status = eeprom_cache_drop(a, mem_address, datasize);
+    if (status != EEPROM_OK) {
+        return status;
+    }
+#endif
+    return eeprom_write_from(a, a->geometry, mem_address, data, datasize, EEPROM_SOURCE_PGM, 0);
+}
+
+/**
+ * @brief  To check that the EEPROM holds a byte array
+ * @note   Compares inside the sequential read, so no read buffer is needed, and ends the
+ *         read at the first difference. Pending cache lines are written back first.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *expected: Data Array
+ * @param  datasize: Size of the data array
+ * @param  *mismatch: Offset of the first difference, datasize if all bytes match
+ * @return Status of the write backs and the read, EEPROM_ERROR if the geometry is unknown,
+ *         mismatch is only set on EEPROM_OK
+ */
+eeprom_status eeprom_verify(eeprom *a, uint32_t mem_address, const uint8_t *expected, uint16_t datasize, uint16_t *mismatch) {
+    eeprom_status status = eeprom_flush(a);
+
+    if (status != EEPROM_OK) {
+        return status;
+    }
+    return eeprom_compare_from(a, mem_address, expected, datasize, EEPROM_SOURCE_RAM, mismatch);
+}
+
+/**
+ * @brief  To check that the EEPROM holds a byte array stored in program memory
+ * @note   The data has to sit in the first 64KB of flash.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *expected: Data Array in program memory
+ * @param  datasize: Size of the data array
+ * @param  *mismatch: Offset of the first difference, datasize if all bytes match
+ * @return Status of the write backs and the read, EEPROM_ERROR if the geometry is unknown,
+ *         mismatch is only set on EEPROM_OK
+ */
+eeprom_status eeprom_verify_P(eeprom *a, uint32_t mem_address, const uint8_t *expected, uint16_t datasize, uint16_t *mismatch) {
+    eeprom_status status = eeprom_flush(a);
+
+    if (status != EEPROM_OK) {
+        return status;
+    }
+    return eeprom_compare_from(a, mem_address, expected, datasize, EEPROM_SOURCE_PGM, mismatch);
+}
+
+/**
+ * @brief  To write bytes pulled from a producer
+ * @note   The producer is called once per byte inside the page loop, so the data
+ *         never has to be staged in RAM.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  producer: Returns the next byte to write
+ * @param  *context: Passed to the producer
+ * @param  datasize: Number of bytes to write
+ * @return Status of the transfer
+ */
+eeprom_status eeprom_write_cb(eeprom *a, uint32_t mem_address, eeprom_producer producer, void *context, uint16_t datasize) {
+    eeprom_callbacks cb;
+
+    cb.producer = producer;
+    cb.consumer = 0;
+    cb.context = context;
+#if EEPROM_CACHE_PAGES > 0
+    eeprom_status status = eeprom_cache_drop(a, mem_address, datasize);
+    if (status != EEPROM_OK) {
+        return status;
+    }
+#endif
+    return eeprom_write_from(a, a->geometry, mem_address, (const uint8_t *) (const void *) &cb, datasize, EEPROM_SOURCE_CALLBACK, 0);
+}
+
+/**
+ * @brief  To read bytes into a consumer
+ * @note   The consumer is called once per byte as it comes off the bus.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  consumer: Takes each byte read
+ * @param  *context: Passed to the consumer
+ * @param  datasize: Number of bytes to read
+ * @return Status of the transfer
+ */
+eeprom_status eeprom_read_cb(eeprom *a, uint32_t mem_address, eeprom_consumer consumer, void *context, uint16_t datasize) {
+    eeprom_callbacks cb;
+
+    cb.producer = 0;
+    cb.consumer = consumer;
+    cb.context = context;
+#if EEPROM_CACHE_PAGES > 0
+    eeprom_status status = eeprom_cache_drop(a, mem_address, datasize);             // the chip has to hold the latest data
+    if (status != EEPROM_OK) {
+        return status;
+    }
+#endif
+    return eeprom_read_to(a, a->geometry, mem_address, (uint8_t *) (void *) &cb, datasize, EEPROM_SOURCE_CALLBACK, 0);
+}
+
+/**
+ * @brief  To write a byte array and get its CRC
+ * @note   The CRC is updated byte by byte in the page loop, so several calls can be
+ *         chained on the same CRC. Start from EEPROM_CRC_INIT or any seed you like.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @param  *crc: CRC to start from, updated with the data written
+ * @return Status of the transfer
+ */
+eeprom_status eeprom_write_crc(eeprom *a, uint32_t mem_address, const uint8_t *data, uint16_t datasize, eeprom_crc *crc) {
+#if EEPROM_CACHE_PAGES > 0
+    eeprom_status status = eeprom_cache_drop(a, mem_address, datasize);
+    if (status != EEPROM_OK) {
+        return status;
+    }
+#endif
+    return eeprom_write_from(a, a->geometry, mem_address, data, datasize, EEPROM_SOURCE_RAM, crc);
+}
+
+/**
+ * @brief  To read a byte array and get its CRC
+ * @note   The CRC is computed as the bytes come off the bus, no second pass is needed.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @param  *crc: CRC to start from, updated with the data read
+ * @return Status of the transfer
+ */
+eeprom_status eeprom_read_crc(eeprom *a, uint32_t mem_address, uint8_t *data, uint16_t datasize, eeprom_crc *crc) {
+#if EEPROM_CACHE_PAGES > 0
+    eeprom_status status = eeprom_cache_drop(a, mem_address, datasize);             // the chip has to hold the latest data
+    if (status != EEPROM_OK) {
+        return status;
+    }
+#endif
+    return eeprom_read_to(a, a->geometry, mem_address, data, datasize, EEPROM_SOURCE_RAM, crc);
+}
+
+/**
+ * @brief  A sequential read kept open across calls
+ * @note   While a stream is open the bus belongs to it, close it before any other transfer.
+ */
+typedef struct eeprom_stream {
+    eeprom *dev;                            // EEPROM being read
+    uint32_t mem_address;                   // Address of the next byte
+    uint8_t open;                           // The read transaction is in progress
+}eeprom_stream;
+
+/**
+ * @brief  To start streaming from an address
+ * @note   Sends the memory address once, later reads only cost the data bytes.
+ *         The write-back cache is flushed first so the stream sees all writes.
+ * @param  *s: Address of the stream
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @return Status of addressing the device, the stream is only open on EEPROM_OK
+ */
+eeprom_status eeprom_stream_open(eeprom_stream *s, eeprom *a, uint32_t mem_address) {
+    eeprom_status status;
+
+    s->dev = a;
+    s->mem_address = mem_address;
+    s->open = 0;
+    if (a->geometry.page_size == 0) {
+        return EEPROM_ERROR;
+    }
+    status = eeprom_flush(a);
+    if (status == EEPROM_OK) {
+        status = eeprom_select_read(a, a->geometry, mem_address);
+    }
+    s->open = (status == EEPROM_OK);
+    return status;
+}
+
+/**
+ * @brief  To read the next bytes of a stream
+ * @param  *s: Address of the stream
+ * @param  *data: Data Array
+ * @param  datasize: Number of bytes to read
+ * @return EEPROM_OK, EEPROM_ERROR if the stream is not open
+ */
+eeprom_status eeprom_stream_read(eeprom_stream *s, uint8_t *data, uint16_t datasize) {
+    if (!s->open) {
+        return EEPROM_ERROR;
+    }
+    s->mem_address += datasize;
+    EEPROM_STAT_ADD(s->dev, bytes_read, datasize);
+    while (datasize > 0) {
+        *data++ = i2c_readAck();                                                    // ACK, more may follow
+        --datasize;
+    }
+    return EEPROM_OK;
+}
+
+/**
+ * @brief  To end a stream and release the bus
+ * @note   The read has to end with a NAK, which costs one extra byte.
+ * @param  *s: Address of the stream
+ * @return None
+ */
+void eeprom_stream_close(eeprom_stream *s) {
+    if (s->open) {
+        i2c_readNak();
+        eeprom_stop();
+        s->open = 0;
+    }
+}
+
+/**
+ * @brief  Define a family of access functions for a part fixed at compile time
+ * @note   EEPROM_DEFINE(at24c256, 256) generates at24c256_init(), at24c256_write(),
+ *         at24c256_read(), at24c256_byte_write() and at24c256_byte_read(). The page size,
+ *         address width and block bits are constants in these, so each call inlines to
+ *         straight-line TWI code for that part without looking at the instance geometry.
+ *         They go straight to the chip, past the write-back cache and the read-ahead
+ *         buffer. Reads and writes first write back and drop the cache lines they overlap,
+ *         and writes drop the read-ahead data they overlap, so mixing them with
+ *         eeprom_read() and eeprom_write() is safe.
+ *         at24c256_put() and at24c256_get() move one object, see eeprom_put_geom(). They
+ *         are always inlined, so a constant address plans the page split at compile time.
+ * @param  name: Prefix of the generated functions
+ * @param  kbits: Size of the EEPROM in Kbits
+ */
+#define EEPROM_DEFINE(name, kbits)                                                                  \
+    typedef char name##_size_check[EEPROM_GEOM_VALID(kbits) ? 1 : -1];                              \
+    static inline void name##_init(eeprom *a, uint8_t dev_address) {                                \
+        eeprom_init(a, dev_address, (kbits));                                                       \
+    }                                                                                               \
+    static inline eeprom_status name##_write(eeprom *a, uint32_t mem_address, const uint8_t *data, uint16_t datasize) { \
+        eeprom_status status = eeprom_cache_bypass(a, mem_address, datasize);                        \
+        return (status == EEPROM_OK) ? eeprom_write_geom(a, eeprom_geometry_of(kbits), mem_address, data, datasize) : status; \
+    }                                                                                               \
+    static inline eeprom_status name##_read(eeprom *a, uint32_t mem_address, uint8_t *data, uint16_t datasize) { \
+        eeprom_status status = eeprom_cache_bypass(a, mem_address, datasize);                        \
+        return (status == EEPROM_OK) ? eeprom_read_geom(a, eeprom_geometry_of(kbits), mem_address, data, datasize) : status; \
+    }                                                                                               \
+    static inline eeprom_status name##_byte_write(eeprom *a, uint32_t mem_address, uint8_t data) {  \
+        eeprom_status status = eeprom_cache_bypass(a, mem_address, 1);                               \
+        return (status == EEPROM_OK) ? eeprom_write_geom(a, eeprom_geometry_of(kbits), mem_address, &data, 1) : status; \
+    }                                                                                               \
+    static inline eeprom_status name##_byte_read(eeprom *a, uint32_t mem_address, uint8_t *data) {  \
+        eeprom_status status = eeprom_cache_bypass(a, mem_address, 1);                               \
+        return (status == EEPROM_OK) ? eeprom_read_geom(a, eeprom_geometry_of(kbits), mem_address, data, 1) : status; \
+    }                                                                                               \
+    static EEPROM_ALWAYS_INLINE eeprom_status name##_put(eeprom *a, uint32_t mem_address, const void *value, uint16_t size) { \
+        eeprom_status status = eeprom_cache_bypass(a, mem_address, size);                            \
+        return (status == EEPROM_OK) ? eeprom_put_geom(a, eeprom_geometry_of(kbits), mem_address, value, size) : status; \
+    }                                                                                               \
+    static EEPROM_ALWAYS_INLINE eeprom_status name##_get(eeprom *a, uint32_t mem_address, void *value, uint16_t size) { \
+        eeprom_status status = eeprom_cache_bypass(a, mem_address, size);                            \
+        return (status == EEPROM_OK) ? eeprom_read_geom(a, eeprom_geometry_of(kbits), mem_address, (uint8_t *) value, size) : status; \
+    }                                                                                               \
+    EEPROM_DEFINE_TYPED(name)
+
+/**
+ * @brief  Write an object to an EEPROM
+ * @note   EEPROM_PUT(&eep1, 0x0100, cfg) stores the bytes of cfg, through the cache if enabled.
+ * @param  a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  value: Object, an lvalue of any type without pointers meant to survive a reset
+ */
+#define EEPROM_PUT(a, mem_address, value)   eeprom_write((a), (mem_address), (uint8_t *) &(value), sizeof (value))
+
+/**
+ * @brief  Read an object from an EEPROM
+ * @param  a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  value: Object to fill, an lvalue
+ */
+#define EEPROM_GET(a, mem_address, value)   eeprom_read((a), (mem_address), (uint8_t *) &(value), sizeof (value))
+
+#ifdef __cplusplus
+/**
+ * @brief  To write an object, C++ form of EEPROM_PUT()
+ * @note   Goes through eeprom_write(), so the page split is planned at run time from the
+ *         geometry of the instance. Give the size of the part, eeprom_put<256>(&eep, 0x40, cfg),
+ *         or use the put of an EEPROM_DEFINE() family to have it planned at compile time.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  &value: Object, of a trivially copyable type
+ * @return Status of the transfer
+ */
+template <typename T>
+static inline eeprom_status eeprom_put(eeprom *a, uint32_t mem_address, const T &value) {
+    return eeprom_write(a, mem_address, (uint8_t *) &value, sizeof (T));
+}
+
+/**
+ * @brief  To read an object, C++ form of EEPROM_GET()
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  &value: Object to fill, of a trivially copyable type
+ * @return Status of the transfer
+ */
+template <typename T>
+static inline eeprom_status eeprom_get(eeprom *a, uint32_t mem_address, T &value) {
+    return eeprom_read(a, mem_address, (uint8_t *) &value, sizeof (T));
+}
+
+/**
+ * @brief  To write an object to a part of a size known at compile time
+ * @note   eeprom_put<256>(&eep, 0x40, cfg) works like the put of an EEPROM_DEFINE() family,
+ *         see eeprom_put_geom(). With a constant address the page split is planned at
+ *         compile time. It goes past the write-back cache after writing back the lines
+ *         it overlaps.
+ * @param  kbits: Size of the EEPROM in Kbits
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  &value: Object, of a trivially copyable type
+ * @return Status of the transfer
+ */
+template <uint16_t kbits, typename T>
+static EEPROM_ALWAYS_INLINE eeprom_status eeprom_put(eeprom *a, uint32_t mem_address, const T &value) {
+    (void) sizeof (char[EEPROM_GEOM_VALID(kbits) ? 1 : -1]);
+    eeprom_status status = eeprom_cache_bypass(a, mem_address, sizeof (T));
+    return (status == EEPROM_OK) ? eeprom_put_geom(a, eeprom_geometry_of(kbits), mem_address, &value, sizeof (T)) : status;
+}
+
+/**
+ * @brief  To read an object from a part of a size known at compile time
+ * @note   eeprom_get<256>(&eep, 0x40, cfg), the counterpart of eeprom_put<kbits>().
+ * @param  kbits: Size of the EEPROM in Kbits
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  &value: Object to fill, of a trivially copyable type
+ * @return Status of the transfer
+ */
+template <uint16_t kbits, typename T>
+static EEPROM_ALWAYS_INLINE eeprom_status eeprom_get(eeprom *a, uint32_t mem_address, T &value) {
+    (void) sizeof (char[EEPROM_GEOM_VALID(kbits) ? 1 : -1]);
+    eeprom_status status = eeprom_cache_bypass(a, mem_address, sizeof (T));
+    return (status == EEPROM_OK) ? eeprom_read_geom(a, eeprom_geometry_of(kbits), mem_address, (uint8_t *) &value, sizeof (T)) : status;
+}
+
+// Typed overloads of the put and get of an EEPROM_DEFINE() family, at24c256_put(&eep, 0x40, cfg)
+#define EEPROM_DEFINE_TYPED(name)                                                                   \
+    template <typename T>                                                                           \
+    static EEPROM_ALWAYS_INLINE eeprom_status name##_put(eeprom *a, uint32_t mem_address, const T &value) { \
+        return name##_put(a, mem_address, &value, sizeof (T));                                      \
+    }                                                                                               \
+    template <typename T>                                                                           \
+    static EEPROM_ALWAYS_INLINE eeprom_status name##_get(eeprom *a, uint32_t mem_address, T &value) { \
+        return name##_get(a, mem_address, &value, sizeof (T));                                      \
+    }
+#else
+#define EEPROM_DEFINE_TYPED(name)
+#endif
+
+#ifdef EEPROM_ASYNC
+#if EEPROM_BUS != EEPROM_BUS_TWI
+#error "EEPROM_ASYNC drives the TWI directly and needs EEPROM_BUS_TWI"
+#endif
+/*
+ * Interrupt driven transfers
+ *
+ * Define EEPROM_ASYNC before including this file to get eeprom_write_async() and
+ * eeprom_read_async(). The TWI interrupt walks the same page split as eeprom_write() and
+ * ACK-polls the write cycle of each page by itself, so the CPU only spends a few cycles
+ * per bus event. A read sends the memory address, turns the bus around with a repeated
+ * START and stores one byte per interrupt.
+ * One transfer runs at a time. Do not call the blocking functions while eeprom_poll()
+ * returns EEPROM_BUSY, as they share the TWI with the interrupt handler.
+ * Asynchronous transfers go past the write-back cache. Before starting, they write back
+ * and drop the cache lines they overlap, which may block for those page writes.
+ */
+#include <avr/interrupt.h>
+#include <util/twi.h>
+
+/**
+ * @brief  Completion callback of an asynchronous transfer
+ * @note   Called from the TWI interrupt
+ */
+typedef void (*eeprom_callback)(eeprom *a, eeprom_status status);
+
+#define EEPROM_TWCR_NEXT    ((1 << TWINT) | (1 << TWEN) | (1 << TWIE))             // release TWINT, keep the interrupt on
+#define EEPROM_TWCR_RESTART (EEPROM_TWCR_NEXT | (1 << TWSTO) | (1 << TWSTA))        // STOP followed by START
+#define EEPROM_TWCR_STOP    ((1 << TWINT) | (1 << TWEN) | (1 << TWSTO))             // STOP and hand the TWI back
+
+enum {
+    EEPROM_ASYNC_IDLE = 0,
+    EEPROM_ASYNC_WRITE,                     // Sending pages
+    EEPROM_ASYNC_COMMIT,                    // Last page sent, polling until its write cycle ends
+    EEPROM_ASYNC_READ_ADDR,                 // Sending the memory address of a read
+    EEPROM_ASYNC_READ                       // Receiving after the repeated START
+};
+
+typedef struct eeprom_async_job {
+    eeprom *dev;                            // EEPROM being accessed
+    const uint8_t *data;                    // Next byte to send
+    uint8_t *buffer;                        // Next byte to receive
+    uint32_t mem_address;                   // Next address to write
+    uint16_t remaining;                     // Bytes left in the transfer
+    uint16_t chunk;                         // Bytes left in the current page
+    uint8_t header;                         // Memory address bytes left to send
+    uint16_t polls;                         // Poll attempts left before EEPROM_TIMEOUT, 0 for no limit
+    uint8_t state;
+    eeprom_status status;                   // Result of the last transfer
+    eeprom_callback callback;
+}eeprom_async_job;
+
+static volatile eeprom_async_job eeprom_job;
+
+/**
+ * @brief  End the current transfer and report it
+ * @param  status: Result of the transfer
+ * @return None
+ */
+static void eeprom_async_finish(eeprom_status status) {
+    eeprom_callback callback = eeprom_job.callback;
+    uint8_t writing = eeprom_job.state < EEPROM_ASYNC_READ_ADDR;
+
+    TWCR = EEPROM_TWCR_STOP;
+    eeprom_job.state = EEPROM_ASYNC_IDLE;
+    eeprom_job.status = status;
+    eeprom_bus_claimed = 0;
+    if (status == EEPROM_OK) {
+        eeprom_job.dev->write_pending = 0;                                          // the device has ACKed its address
+    } else if (writing) {
+        eeprom_cycle_started(eeprom_job.dev);                                       // a page may have been committed
+    }
+    if (callback) {
+        callback(eeprom_job.dev, status);
+    }
+}
+
+/**
+ * @brief  To start writing a byte array in the background
+ * @note   data must stay valid until the transfer has completed.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @param  callback: Called once the last page is committed, may be NULL
+ * @return EEPROM_OK if started, EEPROM_BUSY if a transfer is running, EEPROM_ERROR on bad arguments,
+ *         or the status of a failed cache write back
+ */
+eeprom_status eeprom_write_async(eeprom *a, uint32_t mem_address, const uint8_t *data, uint16_t datasize, eeprom_callback callback) {
+    eeprom_status status;
+
+    if (eeprom_job.state != EEPROM_ASYNC_IDLE) {
+        return EEPROM_BUSY;
+    }
+    if (a->geometry.page_size == 0 || datasize == 0) {
+        return EEPROM_ERROR;
+    }
+    status = eeprom_cache_bypass(a, mem_address, datasize);                         // no cached copy may outlive the write
+    if (status != EEPROM_OK) {
+        return status;
+    }
+#if EEPROM_READAHEAD > 0
+    eeprom_ahead_drop(a, mem_address, datasize);
+#endif
+    eeprom_job.dev = a;
+    eeprom_job.data = data;
+    eeprom_job.mem_address = mem_address;
+    eeprom_job.remaining = datasize;
+    eeprom_job.callback = callback;
+    eeprom_job.status = EEPROM_BUSY;
+    eeprom_job.polls = a->poll_limit;
+    eeprom_job.state = EEPROM_ASYNC_WRITE;
+    eeprom_bus_claimed = 1;                                                         // the interrupt owns the TWI until it finishes
+
+    while (TWCR & (1 << TWSTO));                                                   // let a previous STOP finish
+    eeprom_clock_select(a);
+    TWCR = EEPROM_TWCR_NEXT | (1 << TWSTA);
+    return EEPROM_OK;
+}
+
+/**
+ * @brief  To start reading a byte array in the background
+ * @note   data must stay valid and untouched until the transfer has completed.
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @param  callback: Called once the last byte is stored, may be NULL
+ * @return EEPROM_OK if started, EEPROM_BUSY if a transfer is running, EEPROM_ERROR on bad arguments,
+ *         or the status of a failed cache write back
+ */
+eeprom_status eeprom_read_async(eeprom *a, uint32_t mem_address, uint8_t *data, uint16_t datasize, eeprom_callback callback) {
+    eeprom_status status;
+
+    if (eeprom_job.state != EEPROM_ASYNC_IDLE) {
+        return EEPROM_BUSY;
+    }
+    if (a->geometry.page_size == 0 || datasize == 0) {
+        return EEPROM_ERROR;
+    }
+    status = eeprom_cache_bypass(a, mem_address, datasize);                         // the chip has to hold the latest data
+    if (status != EEPROM_OK) {
+        return status;
+    }
+    eeprom_job.dev = a;
+    eeprom_job.buffer = data;
+    eeprom_job.mem_address = mem_address;
+    eeprom_job.remaining = datasize;
+    eeprom_job.callback = callback;
+    eeprom_job.status = EEPROM_BUSY;
+    eeprom_job.polls = a->poll_limit;
+    eeprom_job.state = EEPROM_ASYNC_READ_ADDR;
+    eeprom_bus_claimed = 1;
+
+    while (TWCR & (1 << TWSTO));                                                   // let a previous STOP finish
+    eeprom_clock_select(a);
+    TWCR = EEPROM_TWCR_NEXT | (1 << TWSTA);
+    return EEPROM_OK;
+}
+
+/**
+ * @brief  To check on the background transfer
+ * @return EEPROM_BUSY while a transfer is running, otherwise the result of the last one
+ */
+eeprom_status eeprom_poll(void) {
+    return (eeprom_job.state != EEPROM_ASYNC_IDLE) ? EEPROM_BUSY : eeprom_job.status;
+}
+
+ISR(TWI_vect) {
+    eeprom *a = eeprom_job.dev;
+
+    switch (TW_STATUS) {
+    case TW_START:
+    case TW_REP_START:
+        EEPROM_STAT_ADD(a, starts, 1);
+        TWDR = eeprom_device_address(a, a->geometry, eeprom_job.mem_address)
+             + ((eeprom_job.state == EEPROM_ASYNC_READ) ? I2C_READ : I2C_WRITE);
+        TWCR = EEPROM_TWCR_NEXT;
+        break;
+
+    case TW_MT_SLA_NACK:
+        EEPROM_STAT_ADD(a, ack_polls, 1);
+        if (eeprom_job.polls != 0 && --eeprom_job.polls == 0) {
+            eeprom_async_finish(EEPROM_TIMEOUT);
+            break;
+        }
+        TWCR = EEPROM_TWCR_RESTART;                                                 // still in the write cycle, poll again
+        break;
+
+    case TW_MT_SLA_ACK:
+        if (eeprom_job.state == EEPROM_ASYNC_COMMIT) {
+            eeprom_async_finish(EEPROM_OK);                                         // the last page is committed
+            break;
+        }
+        eeprom_job.polls = a->poll_limit;                                           // a fresh budget for the next write cycle
+        eeprom_job.header = a->geometry.addr_bytes;
+        eeprom_job.chunk = (eeprom_job.state == EEPROM_ASYNC_WRITE)
+                         ? eeprom_page_chunk(a->geometry, eeprom_job.mem_address, eeprom_job.remaining) : 0;
+        /* fall through */
+    case TW_MT_DATA_ACK:
+        if (eeprom_job.header > 0) {
+            --eeprom_job.header;
+            TWDR = (uint8_t) (eeprom_job.mem_address >> (8 * eeprom_job.header));  // MSB address first
+            TWCR = EEPROM_TWCR_NEXT;
+        } else if (eeprom_job.chunk > 0) {
+            TWDR = *eeprom_job.data++;
+            EEPROM_STAT_ADD(a, bytes_written, 1);
+            --eeprom_job.chunk;
+            --eeprom_job.remaining;
+            ++eeprom_job.mem_address;
+            TWCR = EEPROM_TWCR_NEXT;
+        } else if (eeprom_job.state == EEPROM_ASYNC_READ_ADDR) {
+            eeprom_job.state = EEPROM_ASYNC_READ;
+            TWCR = EEPROM_TWCR_NEXT | (1 << TWSTA);                                 // repeated START to turn the bus around
+        } else {
+            // page done, the STOP starts its write cycle and the START polls for the end of it
+            if (eeprom_job.remaining == 0) {
+                eeprom_job.state = EEPROM_ASYNC_COMMIT;
+            }
+            EEPROM_STAT_ADD(a, page_writes, 1);
+            TWCR = EEPROM_TWCR_RESTART;
+        }
+        break;
+
+    case TW_MR_DATA_ACK:
+    case TW_MR_DATA_NACK:
+        *eeprom_job.buffer++ = TWDR;
+        EEPROM_STAT_ADD(a, bytes_read, 1);
+        if (--eeprom_job.remaining == 0) {
+            eeprom_async_finish(EEPROM_OK);
+            break;
+        }
+        /* fall through */
+    case TW_MR_SLA_ACK:
+        TWCR = (eeprom_job.remaining > 1) ? (EEPROM_TWCR_NEXT | (1 << TWEA)) : EEPROM_TWCR_NEXT;  // NAK the last byte
+        break;
+
+    case TW_MT_DATA_NACK:
+    case TW_MR_SLA_NACK:
+        eeprom_async_finish(EEPROM_NACK);
+        break;
+
+    default:                                                                        // lost arbitration or bus error
+        eeprom_async_finish(EEPROM_ERROR);
+        break;
+    }
+}
+#endif
+
+#endif
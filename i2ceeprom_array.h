@@ -0,0 +1,128 @@
+/**
+ * @file
+ * @code #include "i2ceeprom_array.h"
+ * @endcode
+ *
+ * @brief Striping of several 24CXX EEPROMs on one bus.
+ *
+ * Consecutive pages of the array go to the chips round robin, so while one chip
+ * is busy with its internal write cycle the next page is already being sent to
+ * another one. Sustained write throughput goes up about N-fold with N chips.
+ *
+ * All chips of an array must be of the same size.
+ *
+ * @par Usage Example:
+ *
+ * @code
+ * eeprom eep1, eep2;
+ * eeprom_init(&eep1, 0xA0, 256);
+ * eeprom_init(&eep2, 0xA2, 256);
+ *
+ * eeprom *chips[] = {&eep1, &eep2};
+ * eeprom_array log_array;
+ * eeprom_array_init(&log_array, chips, 2);            // 64KB across two chips
+ *
+ * eeprom_array_write(&log_array, 0x00, record, sizeof record);
+ * @endcode
+ */
+
+#ifndef I2CEEPROM_ARRAY_H
+#define I2CEEPROM_ARRAY_H
+
+#include "i2ceeprom.h"
+
+/**
+ * @brief  A group of EEPROMs striped page by page
+ */
+typedef struct eeprom_array {
+    eeprom **chips;                         // Member EEPROMs, in stripe order
+    uint8_t count;                          // Number of chips
+    uint16_t page_size;                     // Stripe unit, the page size of the chips
+}eeprom_array;
+
+/**
+ * @brief  To group initialised EEPROMs into an array
+ * @param  *s: Address of the array instance
+ * @param  **chips: Array of EEPROM instances, all of the same size
+ * @param  count: Number of EEPROMs
+ * @return None
+ */
+void eeprom_array_init(eeprom_array *s, eeprom **chips, uint8_t count) {
+    s->chips = chips;
+    s->count = count;
+    s->page_size = (count > 0) ? chips[0]->geometry.page_size : 0;
+}
+
+/**
+ * @brief  Size of the array
+ * @param  *s: Address of the array instance
+ * @return Size in bytes
+ */
+uint32_t eeprom_array_size(eeprom_array *s) {
+    return (s->count > 0) ? (uint32_t) s->count * s->chips[0]->eeprom_size * 128 : 0;
+}
+
+/**
+ * @brief  Walk a transfer page by page across the chips
+ * @note   Uses the page split of eeprom_write(), each page lands on the next chip.
+ * @param  *s: Address of the array instance
+ * @param  address: Starting address in the array
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @param  write: 1 to write, 0 to read
+ * @return EEPROM_OK, or the first failure, after which nothing more is transferred
+ */
+static eeprom_status eeprom_array_transfer(eeprom_array *s, uint32_t address, uint8_t *data, uint16_t datasize, uint8_t write) {
+    eeprom_status status = EEPROM_OK;
+    eeprom_geometry g;
+    uint32_t page;
+    uint16_t chunk;
+    eeprom *chip;
+    uint32_t chip_address;
+
+    if (s->count == 0 || s->page_size == 0) {
+        return EEPROM_ERROR;
+    }
+    g = s->chips[0]->geometry;
+    while (datasize > 0 && status == EEPROM_OK) {
+        chunk = eeprom_page_chunk(g, address, datasize);
+        page = address / s->page_size;
+        chip = s->chips[page % s->count];
+        chip_address = (page / s->count) * s->page_size + (address & (s->page_size - 1));
+        if (write) {
+            status = eeprom_write(chip, chip_address, data, chunk);                 // only waits if this chip is still busy
+        } else {
+            status = eeprom_read(chip, chip_address, data, chunk);
+        }
+        address += chunk;
+        data += chunk;
+        datasize -= chunk;
+    }
+    return status;
+}
+
+/**
+ * @brief  To write a byte array to the array
+ * @param  *s: Address of the array instance
+ * @param  address: Starting address in the array
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @return Status of the transfer
+ */
+eeprom_status eeprom_array_write(eeprom_array *s, uint32_t address, uint8_t *data, uint16_t datasize) {
+    return eeprom_array_transfer(s, address, data, datasize, 1);
+}
+
+/**
+ * @brief  To read a byte array from the array
+ * @param  *s: Address of the array instance
+ * @param  address: Starting address in the array
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @return Status of the transfer
+ */
+eeprom_status eeprom_array_read(eeprom_array *s, uint32_t address, uint8_t *data, uint16_t datasize) {
+    return eeprom_array_transfer(s, address, data, datasize, 0);
+}
+
+#endif
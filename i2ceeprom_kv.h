@@ -0,0 +1,396 @@
+/**
+ * @file
+ * @code #include "i2ceeprom_kv.h"
+ * @endcode
+ *
+ * @brief Small key-value store on a 24CXX EEPROM.
+ *
+ * Values are appended log style, a newer entry for a key hides the older ones.
+ * At init the entries are scanned once to build an index in RAM from key to
+ * address, after that a lookup is a single sequential read.
+ *
+ * The first byte of an entry is written last, over the 0xFF of the old terminator,
+ * so a reset while appending leaves the entry unseen rather than half written.
+ *
+ * The region is split in two banks. When the active bank is full the live entries
+ * are copied page by page into the other bank, whose header is written last with
+ * the next generation number, so a reset during compaction leaves the old bank in use.
+ * All of this goes straight to the chip, past the write-back cache, so the order holds.
+ *
+ * Set EEPROM_KV_KEY_BYTES to 1 or 2 for 8 or 16 bit keys, the keys whose first byte
+ * has all bits set are reserved (0xFF, or 0xFF00 to 0xFFFF). EEPROM_KV_MAX_KEYS sets
+ * the size of the RAM index.
+ *
+ * @par Usage Example:
+ *
+ * @code
+ * static uint8_t kv_page[64];                         // one page of a 24C256
+ * eeprom_kv params;
+ * eeprom_kv_init(&params, &eep1, 0x4000, 64, kv_page);
+ *
+ * eeprom_kv_put(&params, PARAM_GAIN, (uint8_t *) &gain, sizeof gain);
+ * eeprom_kv_get(&params, PARAM_GAIN, (uint8_t *) &gain, sizeof gain);
+ * @endcode
+ */
+
+#ifndef I2CEEPROM_KV_H
+#define I2CEEPROM_KV_H
+
+#include "i2ceeprom.h"
+
+#ifndef EEPROM_KV_KEY_BYTES
+#define EEPROM_KV_KEY_BYTES     1
+#endif
+#ifndef EEPROM_KV_MAX_KEYS
+#define EEPROM_KV_MAX_KEYS      16
+#endif
+
+#if EEPROM_KV_KEY_BYTES == 1
+typedef uint8_t eeprom_kv_key;
+#define EEPROM_KV_NO_KEY        0xFF
+#elif EEPROM_KV_KEY_BYTES == 2
+typedef uint16_t eeprom_kv_key;
+#define EEPROM_KV_NO_KEY        0xFFFF
+#else
+#error "EEPROM_KV_KEY_BYTES must be 1 or 2"
+#endif
+
+#define EEPROM_KV_MAGIC         0x4B        // First byte of a bank header, followed by the generation
+#define EEPROM_KV_BANK_HEADER   2
+#define EEPROM_KV_ENTRY_HEADER  (EEPROM_KV_KEY_BYTES + 1)
+
+/**
+ * @brief  Where the newest value of a key is stored
+ */
+typedef struct eeprom_kv_slot {
+    uint32_t address;                       // Address of the value
+    eeprom_kv_key key;
+    uint8_t length;                         // Length of the value
+}eeprom_kv_slot;
+
+/**
+ * @brief  This creates a new key-value store instance
+ */
+typedef struct eeprom_kv {
+    eeprom *dev;                            // EEPROM holding the store
+    uint32_t bank_size;                     // Size of each bank in bytes
+    uint32_t bank;                          // Address of the active bank
+    uint32_t other;                         // Address of the spare bank
+    uint32_t end;                           // Address of the terminator after the last entry
+    uint8_t generation;                     // Generation of the active bank
+    uint8_t keys;                           // Slots of the index in use
+    uint8_t *buffer;                        // One page, used for compaction
+    eeprom_kv_slot index[EEPROM_KV_MAX_KEYS];
+}eeprom_kv;
+
+/**
+ * @brief  Entry being appended, fed to eeprom_write_cb() one byte at a time
+ */
+typedef struct eeprom_kv_entry {
+    const uint8_t *value;
+    uint16_t position;                      // Bytes produced so far
+    eeprom_kv_key key;
+    uint8_t length;
+}eeprom_kv_entry;
+
+static uint8_t eeprom_kv_entry_byte(void *context) {
+    eeprom_kv_entry *e = (eeprom_kv_entry *) context;
+    uint16_t i = e->position++;
+
+    if (i < EEPROM_KV_KEY_BYTES) {
+        return (uint8_t) (e->key >> (8 * (EEPROM_KV_KEY_BYTES - 1 - i)));           // key, MSB first
+    }
+    i -= EEPROM_KV_KEY_BYTES;
+    if (i == 0) {
+        return e->length;
+    }
+    --i;
+    if (i < e->length) {
+        return e->value[i];
+    }
+    return 0xFF;                                                                    // terminator
+}
+
+/**
+ * @brief  Find the index slot of a key
+ * @param  *kv: Address of the key-value store instance
+ * @param  key: Key to look up
+ * @return Slot number, -1 if the key is not stored
+ */
+static int8_t eeprom_kv_find(eeprom_kv *kv, eeprom_kv_key key) {
+    for (uint8_t i = 0; i < kv->keys; ++i) {
+        if (kv->index[i].key == key) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief  Build the index from the entries of the active bank
+ * @param  *kv: Address of the key-value store instance
+ * @return Status of the reads, the index only holds the entries before a failure
+ */
+static eeprom_status eeprom_kv_scan(eeprom_kv *kv) {
+    uint8_t header[EEPROM_KV_ENTRY_HEADER];
+    uint32_t position = kv->bank + EEPROM_KV_BANK_HEADER;
+    uint32_t limit = kv->bank + kv->bank_size;
+    eeprom_kv_key key;
+    int8_t slot;
+    eeprom_status status = EEPROM_OK;
+
+    kv->keys = 0;
+    while (position + EEPROM_KV_ENTRY_HEADER <= limit) {
+        status = eeprom_read(kv->dev, position, header, EEPROM_KV_ENTRY_HEADER);
+        if (status != EEPROM_OK) {
+            break;
+        }
+        key = header[0];
+#if EEPROM_KV_KEY_BYTES == 2
+        key = (eeprom_kv_key) ((key << 8) | header[1]);
+#endif
+        if (header[0] == 0xFF || position + EEPROM_KV_ENTRY_HEADER + header[EEPROM_KV_KEY_BYTES] > limit) {
+            break;                                                                  // terminator or an entry not yet committed
+        }
+        slot = eeprom_kv_find(kv, key);
+        if (slot < 0 && kv->keys < EEPROM_KV_MAX_KEYS) {
+            slot = kv->keys++;
+            kv->index[slot].key = key;
+        }
+        if (slot >= 0) {
+            kv->index[slot].address = position + EEPROM_KV_ENTRY_HEADER;
+            kv->index[slot].length = header[EEPROM_KV_KEY_BYTES];
+        }
+        position += EEPROM_KV_ENTRY_HEADER + header[EEPROM_KV_KEY_BYTES];
+    }
+    kv->end = position;
+    return status;
+}
+
+/**
+ * @brief  Start a bank with a header and a terminator
+ * @param  *kv: Address of the key-value store instance
+ * @return Status of the write
+ */
+static eeprom_status eeprom_kv_format(eeprom_kv *kv) {
+    uint8_t header[EEPROM_KV_BANK_HEADER + EEPROM_KV_KEY_BYTES];
+
+    header[0] = EEPROM_KV_MAGIC;
+    header[1] = kv->generation;
+    for (uint8_t i = 0; i < EEPROM_KV_KEY_BYTES; ++i) {
+        header[EEPROM_KV_BANK_HEADER + i] = 0xFF;
+    }
+    kv->end = kv->bank + EEPROM_KV_BANK_HEADER;
+    kv->keys = 0;
+    return eeprom_write_direct(kv->dev, kv->bank, header, sizeof header);
+}
+
+/**
+ * @brief  To open a key-value store in a region of an EEPROM
+ * @note   Picks the newer valid bank and builds the index, an empty region is formatted.
+ * @param  *kv: Address of the key-value store instance
+ * @param  *a: Address of the EEPROM instance
+ * @param  start: Page aligned start of the region
+ * @param  pages: Number of pages in the region, split into two banks
+ * @param  *buffer: RAM for one page of the EEPROM
+ * @return Status of the transfers, nothing is formatted if the bank headers cannot be read
+ */
+eeprom_status eeprom_kv_init(eeprom_kv *kv, eeprom *a, uint32_t start, uint16_t pages, uint8_t *buffer) {
+    uint8_t header0[EEPROM_KV_BANK_HEADER], header1[EEPROM_KV_BANK_HEADER];
+    uint8_t valid0, valid1;
+    eeprom_status status;
+
+    kv->dev = a;
+    kv->buffer = buffer;
+    kv->bank_size = (uint32_t) (pages / 2) * a->geometry.page_size;
+    kv->keys = 0;
+    status = eeprom_read(a, start, header0, EEPROM_KV_BANK_HEADER);
+    if (status == EEPROM_OK) {
+        status = eeprom_read(a, start + kv->bank_size, header1, EEPROM_KV_BANK_HEADER);
+    }
+    if (status != EEPROM_OK) {
+        return status;
+    }
+    valid0 = (header0[0] == EEPROM_KV_MAGIC);
+    valid1 = (header1[0] == EEPROM_KV_MAGIC);
+
+    // bank 1 is in use if it is the only valid one or one generation ahead
+    if (valid1 && (!valid0 || (uint8_t) (header1[1] - header0[1]) == 1)) {
+        kv->bank = start + kv->bank_size;
+        kv->other = start;
+        kv->generation = header1[1];
+    } else {
+        kv->bank = start;
+        kv->other = start + kv->bank_size;
+        kv->generation = valid0 ? header0[1] : 0;
+    }
+    if (!valid0 && !valid1) {
+        return eeprom_kv_format(kv);
+    }
+    return eeprom_kv_scan(kv);
+}
+
+/**
+ * @brief  Copy bytes into the compaction buffer, writing out each page as it fills
+ * @param  *kv: Address of the key-value store instance
+ * @param  *position: Address in the new bank the buffer starts at, moved on as pages are written
+ * @param  *fill: Bytes held in the buffer
+ * @param  *data: Bytes to add, NULL to read them from from_address
+ * @param  from_address: EEPROM address of the bytes when data is NULL
+ * @param  datasize: Number of bytes
+ * @return Status of the transfers, stops at the first failure
+ */
+static eeprom_status eeprom_kv_emit(eeprom_kv *kv, uint32_t *position, uint16_t *fill, const uint8_t *data, uint32_t from_address, uint16_t datasize) {
+    uint16_t page_size = kv->dev->geometry.page_size;
+    uint16_t room, chunk;
+    eeprom_status status = EEPROM_OK;
+
+    while (datasize > 0 && status == EEPROM_OK) {
+        room = page_size - (uint16_t) ((*position + *fill) & (page_size - 1));
+        chunk = (datasize < room) ? datasize : room;
+        if (data) {
+            for (uint16_t i = 0; i < chunk; ++i) {
+                kv->buffer[*fill + i] = data[i];
+            }
+            data += chunk;
+        } else {
+            status = eeprom_read(kv->dev, from_address, kv->buffer + *fill, chunk);
+            from_address += chunk;
+        }
+        *fill += chunk;
+        datasize -= chunk;
+        if (chunk == room && status == EEPROM_OK) {
+            status = eeprom_write_direct(kv->dev, *position, kv->buffer, *fill);     // one full page
+            *position += *fill;
+            *fill = 0;
+        }
+    }
+    return status;
+}
+
+/**
+ * @brief  To rewrite the live entries into the spare bank
+ * @note   Called by eeprom_kv_put() when the active bank is full. If a transfer fails
+ *         the new bank header is not written and the index is rebuilt from the old bank.
+ * @param  *kv: Address of the key-value store instance
+ * @return Status of the transfers
+ */
+eeprom_status eeprom_kv_compact(eeprom_kv *kv) {
+    uint8_t header[EEPROM_KV_ENTRY_HEADER];
+    uint32_t position = kv->other + EEPROM_KV_BANK_HEADER;
+    uint16_t fill = 0;
+    uint32_t swap;
+    eeprom_status status = EEPROM_OK;
+
+    for (uint8_t i = 0; i < kv->keys && status == EEPROM_OK; ++i) {
+        eeprom_kv_slot *slot = &kv->index[i];
+        for (uint8_t k = 0; k < EEPROM_KV_KEY_BYTES; ++k) {
+            header[k] = (uint8_t) (slot->key >> (8 * (EEPROM_KV_KEY_BYTES - 1 - k)));
+        }
+        header[EEPROM_KV_KEY_BYTES] = slot->length;
+        status = eeprom_kv_emit(kv, &position, &fill, header, 0, EEPROM_KV_ENTRY_HEADER);
+        if (status == EEPROM_OK) {
+            status = eeprom_kv_emit(kv, &position, &fill, 0, slot->address, slot->length);
+        }
+        slot->address = position + fill - slot->length;
+    }
+    for (uint8_t k = 0; k < EEPROM_KV_KEY_BYTES; ++k) {
+        header[k] = 0xFF;
+    }
+    if (status == EEPROM_OK) {
+        status = eeprom_kv_emit(kv, &position, &fill, header, 0, EEPROM_KV_KEY_BYTES);  // terminator
+    }
+    if (status == EEPROM_OK && fill > 0) {
+        status = eeprom_write_direct(kv->dev, position, kv->buffer, fill);
+    }
+
+    // the new header goes last, until then a reset finds the old bank
+    header[0] = EEPROM_KV_MAGIC;
+    header[1] = kv->generation + 1;
+    if (status == EEPROM_OK) {
+        status = eeprom_write_direct(kv->dev, kv->other, header, EEPROM_KV_BANK_HEADER);
+    }
+    if (status != EEPROM_OK) {
+        eeprom_kv_scan(kv);                                                         // slot addresses point into the new bank
+        return status;
+    }
+    kv->end = position + fill - EEPROM_KV_KEY_BYTES;
+    ++kv->generation;
+    swap = kv->bank;
+    kv->bank = kv->other;
+    kv->other = swap;
+    return EEPROM_OK;
+}
+
+/**
+ * @brief  To store a value
+ * @note   The entry past its first byte and the new terminator go out first, then the
+ *         first byte replaces the old terminator and commits the entry.
+ * @param  *kv: Address of the key-value store instance
+ * @param  key: Key, not one of the reserved keys
+ * @param  *value: Value
+ * @param  length: Length of the value, 1 to 255
+ * @return EEPROM_OK, EEPROM_ERROR if the index or the bank is full, or the status of a failed transfer
+ */
+eeprom_status eeprom_kv_put(eeprom_kv *kv, eeprom_kv_key key, const uint8_t *value, uint8_t length) {
+    uint16_t size = EEPROM_KV_ENTRY_HEADER + length;
+    int8_t slot = eeprom_kv_find(kv, key);
+    uint8_t first = (uint8_t) (key >> (8 * (EEPROM_KV_KEY_BYTES - 1)));
+    eeprom_kv_entry entry;
+    eeprom_status status;
+
+    if (first == 0xFF || length == 0 || (slot < 0 && kv->keys == EEPROM_KV_MAX_KEYS)) {
+        return EEPROM_ERROR;
+    }
+    if (kv->end + size + EEPROM_KV_KEY_BYTES > kv->bank + kv->bank_size) {
+        status = eeprom_kv_compact(kv);
+        if (status != EEPROM_OK) {
+            return status;
+        }
+        if (kv->end + size + EEPROM_KV_KEY_BYTES > kv->bank + kv->bank_size) {
+            return EEPROM_ERROR;
+        }
+    }
+
+    entry.value = value;
+    entry.position = 1;
+    entry.key = key;
+    entry.length = length;
+    status = eeprom_write_cb(kv->dev, kv->end + 1, eeprom_kv_entry_byte, &entry, size + EEPROM_KV_KEY_BYTES - 1);
+    if (status == EEPROM_OK) {
+        status = eeprom_write_direct(kv->dev, kv->end, &first, 1);
+    }
+    if (status != EEPROM_OK) {
+        return status;                                                              // the old value stays current
+    }
+    if (slot < 0) {
+        slot = kv->keys++;
+        kv->index[slot].key = key;
+    }
+    kv->index[slot].address = kv->end + EEPROM_KV_ENTRY_HEADER;
+    kv->index[slot].length = length;
+    kv->end += size;
+    return EEPROM_OK;
+}
+
+/**
+ * @brief  To fetch a value
+ * @param  *kv: Address of the key-value store instance
+ * @param  key: Key to look up
+ * @param  *value: Buffer for the value
+ * @param  size: Size of the buffer, longer values are cut short
+ * @return Length of the stored value, 0 if the key is not stored or cannot be read
+ */
+uint8_t eeprom_kv_get(eeprom_kv *kv, eeprom_kv_key key, uint8_t *value, uint8_t size) {
+    int8_t slot = eeprom_kv_find(kv, key);
+
+    if (slot < 0) {
+        return 0;
+    }
+    if (eeprom_read(kv->dev, kv->index[slot].address, value, (size < kv->index[slot].length) ? size : kv->index[slot].length) != EEPROM_OK) {
+        return 0;
+    }
+    return kv->index[slot].length;
+}
+
+#endif
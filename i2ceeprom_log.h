@@ -0,0 +1,333 @@
+/**
+ * @file
+ * @code #include "i2ceeprom_log.h"
+ * @endcode
+ *
+ * @brief Wear leveled append-only log on a 24CXX EEPROM.
+ *
+ * The log region is a ring of pages. Each page starts with a header holding a
+ * sequence number and a record count, followed by fixed size records. Appends are
+ * gathered in a page buffer and written as one page write when the page is full,
+ * so every write cycle carries as many records as fit. Pages are used strictly in
+ * turn and the oldest page is reused when the ring wraps, which spreads wear over
+ * the whole region.
+ *
+ * A page whose header reads 0xFFFFFFFF has never been written. Fresh parts come
+ * erased this way, a used region has to go through eeprom_log_format() once.
+ *
+ * @par Usage Example:
+ *
+ * @code
+ * static uint8_t log_page[64];                        // one page of a 24C256
+ * eeprom_log events;
+ * eeprom_log_init(&events, &eep1, 0x0000, 512, sizeof(event_t), log_page);
+ *
+ * eeprom_log_append(&events, (uint8_t *) &ev);
+ * eeprom_log_sync(&events);                           // e.g. before going to sleep
+ *
+ * for (uint32_t i = 0; i < eeprom_log_records(&events); ++i) {
+ *     eeprom_log_read(&events, i, (uint8_t *) &ev);   // oldest first
+ * }
+ * @endcode
+ */
+
+#ifndef I2CEEPROM_LOG_H
+#define I2CEEPROM_LOG_H
+
+#include "i2ceeprom.h"
+
+#define EEPROM_LOG_HEADER       5           // 32 bit sequence number, record count
+#define EEPROM_LOG_ERASED       0xFFFFFFFFUL
+
+/**
+ * @brief  This creates a new log instance
+ */
+typedef struct eeprom_log {
+    eeprom *dev;                            // EEPROM holding the log
+    uint32_t start;                         // Address of the first page of the region
+    uint16_t pages;                         // Number of pages in the region
+    uint16_t head;                          // Page being filled
+    uint16_t used;                          // Pages holding records, head included
+    uint32_t sequence;                      // Sequence number of the head page
+    uint8_t record_size;                    // Size of a record in bytes
+    uint8_t per_page;                       // Records per page
+    uint8_t count;                          // Records in the head page
+    uint8_t dirty;                          // Head page has records not yet written
+    uint8_t *buffer;                        // Copy of the head page
+}eeprom_log;
+
+/**
+ * @brief  Address of a page of the log
+ * @param  *l: Address of the log instance
+ * @param  page: Page index in the region
+ * @return Memory address of the page
+ */
+static uint32_t eeprom_log_page_address(eeprom_log *l, uint16_t page) {
+    return l->start + (uint32_t) page * l->dev->geometry.page_size;
+}
+
+/**
+ * @brief  Read the header of a page
+ * @param  *l: Address of the log instance
+ * @param  page: Page index in the region
+ * @param  *sequence: Sequence number, EEPROM_LOG_ERASED if the page was never written
+ * @param  *count: Record count of the page, may be NULL
+ * @return Status of the read, the outputs are only set on EEPROM_OK
+ */
+static eeprom_status eeprom_log_header(eeprom_log *l, uint16_t page, uint32_t *sequence, uint8_t *count) {
+    uint8_t header[EEPROM_LOG_HEADER];
+    eeprom_status status = eeprom_read(l->dev, eeprom_log_page_address(l, page), header, EEPROM_LOG_HEADER);
+
+    if (status != EEPROM_OK) {
+        return status;
+    }
+    *sequence = (uint32_t) header[0] | ((uint32_t) header[1] << 8) | ((uint32_t) header[2] << 16) | ((uint32_t) header[3] << 24);
+    if (count) {
+        *count = header[4];
+    }
+    return EEPROM_OK;
+}
+
+/**
+ * @brief  Write the head page, header and records only
+ * @note   Goes past the write-back cache, so the page write has started when this returns.
+ * @param  *l: Address of the log instance
+ * @return Status of the write, the page stays dirty if it failed
+ */
+static eeprom_status eeprom_log_write_head(eeprom_log *l) {
+    eeprom_status status;
+
+    l->buffer[0] = (uint8_t) l->sequence;
+    l->buffer[1] = (uint8_t) (l->sequence >> 8);
+    l->buffer[2] = (uint8_t) (l->sequence >> 16);
+    l->buffer[3] = (uint8_t) (l->sequence >> 24);
+    l->buffer[4] = l->count;
+    status = eeprom_write_direct(l->dev, eeprom_log_page_address(l, l->head), l->buffer, EEPROM_LOG_HEADER + (uint16_t) l->count * l->record_size);
+    if (status == EEPROM_OK) {
+        l->dirty = 0;
+    }
+    return status;
+}
+
+/**
+ * @brief  Move on to the next page of the ring
+ * @note   Reuses the oldest page once the ring is full.
+ * @param  *l: Address of the log instance
+ * @return None
+ */
+static void eeprom_log_advance(eeprom_log *l) {
+    l->head = (l->head + 1 == l->pages) ? 0 : l->head + 1;
+    ++l->sequence;
+    l->count = 0;
+    if (l->used < l->pages) {
+        ++l->used;
+    }
+}
+
+/**
+ * @brief  Find the newest page
+ * @note   Pages are written in ring order with sequence numbers going up by one, so
+ *         page p is at or before the head exactly when its sequence number is that of
+ *         page 0 plus p. That splits the ring in two and the head is found by binary
+ *         search, reading O(log pages) headers whatever the size of the region.
+ * @param  *l: Address of the log instance
+ * @return Status of the reads, stops at the first failure
+ */
+static eeprom_status eeprom_log_recover(eeprom_log *l) {
+    uint32_t first, sequence;
+    uint16_t low = 0;                                                               // known to be at or before the head
+    uint16_t high = l->pages;                                                       // known to be after the head
+    uint16_t mid;
+    uint8_t count = 0;
+    eeprom_status status = eeprom_log_header(l, 0, &first, 0);
+
+    if (status != EEPROM_OK) {
+        return status;
+    }
+    l->head = 0;
+    l->used = 0;
+    l->sequence = 0;
+    if (first != EEPROM_LOG_ERASED) {
+        while (high - low > 1) {
+            mid = low + (high - low) / 2;
+            status = eeprom_log_header(l, mid, &sequence, 0);
+            if (status != EEPROM_OK) {
+                return status;
+            }
+            if (sequence == first + mid) {
+                low = mid;
+            } else {
+                high = mid;
+            }
+        }
+        l->head = low;
+        l->sequence = first + low;
+        // the ring has wrapped if the page after the head holds older records
+        sequence = EEPROM_LOG_ERASED;
+        if (low + 1 < l->pages) {
+            status = eeprom_log_header(l, low + 1, &sequence, 0);
+            if (status != EEPROM_OK) {
+                return status;
+            }
+        }
+        l->used = (sequence != EEPROM_LOG_ERASED) ? l->pages : low + 1;
+    }
+
+    if (l->used == 0) {
+        l->used = 1;                                                                // start on an empty first page
+        l->count = 0;
+        return EEPROM_OK;
+    }
+    status = eeprom_log_header(l, l->head, &sequence, &count);
+    if (status != EEPROM_OK) {
+        return status;
+    }
+    l->count = (count > l->per_page) ? l->per_page : count;
+    if (l->count == l->per_page) {
+        eeprom_log_advance(l);                                                      // the newest page is full
+        return EEPROM_OK;
+    }
+    return eeprom_read(l->dev, eeprom_log_page_address(l, l->head), l->buffer, EEPROM_LOG_HEADER + (uint16_t) l->count * l->record_size);
+}
+
+/**
+ * @brief  To open a log in a region of an EEPROM
+ * @note   Finds the newest page with a binary search, appends continue where the log left off.
+ *         If a read fails the log is left closed, appends and reads return EEPROM_ERROR
+ *         until eeprom_log_init() succeeds, so no page is written over blindly.
+ * @param  *l: Address of the log instance
+ * @param  *a: Address of the EEPROM instance
+ * @param  start: Page aligned start of the region
+ * @param  pages: Number of pages in the region, at least 2
+ * @param  record_size: Size of a record, at most the page size less EEPROM_LOG_HEADER
+ * @param  *buffer: RAM for one page of the EEPROM
+ * @return Status of the reads
+ */
+eeprom_status eeprom_log_init(eeprom_log *l, eeprom *a, uint32_t start, uint16_t pages, uint8_t record_size, uint8_t *buffer) {
+    eeprom_status status;
+
+    l->dev = a;
+    l->start = start;
+    l->pages = pages;
+    l->record_size = record_size;
+    l->per_page = (a->geometry.page_size > EEPROM_LOG_HEADER && record_size > 0) ? (a->geometry.page_size - EEPROM_LOG_HEADER) / record_size : 0;
+    l->buffer = buffer;
+    l->dirty = 0;
+    l->head = 0;
+    l->used = 1;
+    l->count = 0;
+    status = eeprom_log_recover(l);
+    if (status != EEPROM_OK) {
+        l->per_page = 0;                                                            // closed until opened again
+        l->used = 1;
+        l->count = 0;
+    }
+    return status;
+}
+
+/**
+ * @brief  To erase the log
+ * @note   Marks every page of the region as never written, pages that already are cost no write cycle.
+ * @param  *l: Address of the log instance
+ * @return Status of the writes, the log is left as it was if one failed
+ */
+eeprom_status eeprom_log_format(eeprom_log *l) {
+    static const uint8_t erased[EEPROM_LOG_HEADER] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+    eeprom_status status;
+
+    for (uint16_t page = 0; page < l->pages; ++page) {
+        status = eeprom_update(l->dev, eeprom_log_page_address(l, page), (uint8_t *) erased, EEPROM_LOG_HEADER);
+        if (status != EEPROM_OK) {
+            return status;
+        }
+    }
+    l->head = 0;
+    l->used = 1;
+    l->sequence = 0;
+    l->count = 0;
+    l->dirty = 0;
+    return EEPROM_OK;
+}
+
+/**
+ * @brief  To append a record
+ * @note   The page is written once it is full, call eeprom_log_sync() to write it earlier.
+ * @param  *l: Address of the log instance
+ * @param  *record: Record of record_size bytes
+ * @return Status of the page write if the record filled the page, EEPROM_OK otherwise
+ */
+eeprom_status eeprom_log_append(eeprom_log *l, const uint8_t *record) {
+    eeprom_status status = EEPROM_OK;
+    uint8_t *slot;
+
+    if (l->per_page == 0 || l->count == l->per_page) {
+        return EEPROM_ERROR;                                                        // no room, or a full page that failed to write
+    }
+    slot = l->buffer + EEPROM_LOG_HEADER + (uint16_t) l->count * l->record_size;
+    for (uint8_t i = 0; i < l->record_size; ++i) {
+        slot[i] = record[i];
+    }
+    ++l->count;
+    l->dirty = 1;
+    if (l->count == l->per_page) {
+        status = eeprom_log_write_head(l);                                          // one write cycle for the whole page
+        if (status == EEPROM_OK) {
+            eeprom_log_advance(l);
+        }
+    }
+    return status;
+}
+
+/**
+ * @brief  To write the records gathered so far
+ * @note   Later appends keep filling the same page, which is written again when full.
+ * @param  *l: Address of the log instance
+ * @return Status of the write, EEPROM_OK if there was nothing to write
+ */
+eeprom_status eeprom_log_sync(eeprom_log *l) {
+    eeprom_status status = EEPROM_OK;
+
+    if (l->dirty) {
+        status = eeprom_log_write_head(l);
+        if (status == EEPROM_OK && l->count == l->per_page) {
+            eeprom_log_advance(l);                                                  // retry of a full page after append failed
+        }
+    }
+    return status;
+}
+
+/**
+ * @brief  Number of records in the log
+ * @param  *l: Address of the log instance
+ * @return Record count, written or not
+ */
+uint32_t eeprom_log_records(eeprom_log *l) {
+    return (uint32_t) (l->used - 1) * l->per_page + l->count;
+}
+
+/**
+ * @brief  To read a record
+ * @param  *l: Address of the log instance
+ * @param  index: Record number, 0 is the oldest
+ * @param  *record: Buffer of record_size bytes
+ * @return Status of the read, EEPROM_ERROR if there is no such record
+ */
+eeprom_status eeprom_log_read(eeprom_log *l, uint32_t index, uint8_t *record) {
+    uint16_t tail = (l->head + l->pages - (l->used - 1)) % l->pages;
+    uint16_t offset, page;
+
+    if (index >= eeprom_log_records(l)) {
+        return EEPROM_ERROR;                                                        // also a closed log, per_page is 0
+    }
+    offset = EEPROM_LOG_HEADER + (uint16_t) (index % l->per_page) * l->record_size;
+    page = (uint16_t) (((uint32_t) tail + index / l->per_page) % l->pages);
+    if (page == l->head) {
+        for (uint8_t i = 0; i < l->record_size; ++i) {
+            record[i] = l->buffer[offset + i];                                      // may not be written yet
+        }
+        return EEPROM_OK;
+    }
+    return eeprom_read(l->dev, eeprom_log_page_address(l, page) + offset, record, l->record_size);
+}
+
+#endif
@@ -0,0 +1,435 @@
+/**
+ * @file
+ * @code #include "i2ceeprom_queue.h"
+ * @endcode
+ *
+ * @brief Operation queue and scheduler in front of the transfer functions.
+ *
+ * Modules submit reads and writes as eeprom_op entries and carry on. Each call of
+ * eeprom_queue_run() then performs one bus transaction, picked as follows:
+ *  - a read on a chip that is ready goes first. Data of earlier writes still in the
+ *    queue is laid over what was read, and a read covered by them does not touch the bus.
+ *  - otherwise the oldest write on a ready chip, preferring a different chip from the
+ *    last write, so one chip runs its write cycle while another is served.
+ *  - later writes to the same page that touch or overlap the bytes being written are
+ *    merged into the same page write, the newest data winning.
+ *
+ * A chip in its write cycle is skipped rather than waited for, so eeprom_queue_run()
+ * only blocks for the transaction itself. Readiness is taken from eeprom_is_ready(),
+ * set a tick source and write time with eeprom_set_tick() to avoid probing the bus.
+ *
+ * Entries are owned by the caller and linked into the queue, so no memory is allocated.
+ * An entry and its data must stay valid until its status is no longer EEPROM_BUSY.
+ * The final status is EEPROM_OK, or the error of the transfer or poll budget that failed.
+ *
+ * @par Usage Example:
+ *
+ * @code
+ * eeprom_queue q;
+ * eeprom_op save, load;
+ * eeprom_queue_init(&q);
+ *
+ * eeprom_submit_write(&q, &save, &eep1, 0x0100, settings, sizeof settings);
+ * eeprom_submit_read(&q, &load, &eep2, 0x0000, table, sizeof table);
+ *
+ * while (eeprom_queue_run(&q)) {
+ *     motor_service();
+ * }
+ * @endcode
+ */
+
+#ifndef I2CEEPROM_QUEUE_H
+#define I2CEEPROM_QUEUE_H
+
+#include "i2ceeprom.h"
+
+#ifndef EEPROM_QUEUE_MERGE
+#define EEPROM_QUEUE_MERGE  8               // Most writes merged into one page write
+#endif
+
+#define EEPROM_OP_READ      0
+#define EEPROM_OP_WRITE     1
+
+struct eeprom_op;
+
+/**
+ * @brief  Completion hook of a queued operation
+ */
+typedef void (*eeprom_op_done)(struct eeprom_op *op);
+
+/**
+ * @brief  A queued read or write
+ */
+typedef struct eeprom_op {
+    eeprom *dev;                            // EEPROM being accessed
+    uint32_t mem_address;                   // Starting address
+    uint8_t *data;                          // Data Array, read into or written from
+    uint16_t datasize;                      // Size of the data array
+    uint16_t done;                          // Bytes already written
+    uint16_t polls;                         // Busy polls of the chip since it was last ready
+    uint8_t kind;                           // EEPROM_OP_READ or EEPROM_OP_WRITE
+    eeprom_status status;                   // EEPROM_BUSY while queued
+    eeprom_op_done complete;                // Called once finished, may be NULL
+    struct eeprom_op *next;
+}eeprom_op;
+
+/**
+ * @brief  Queue of pending operations, oldest first
+ */
+typedef struct eeprom_queue {
+    eeprom_op *head;
+    eeprom_op *tail;
+    eeprom *last_write;                     // Chip of the last page write
+    uint8_t count;                          // Operations queued
+}eeprom_queue;
+
+/**
+ * @brief  Writes merged into one page write, newest last
+ */
+typedef struct eeprom_merge {
+    eeprom_op *ops[EEPROM_QUEUE_MERGE];
+    uint8_t count;
+    uint32_t address;                       // Next address being produced
+}eeprom_merge;
+
+/**
+ * @brief  To set up an empty queue
+ * @param  *q: Address of the queue instance
+ * @return None
+ */
+void eeprom_queue_init(eeprom_queue *q) {
+    q->head = 0;
+    q->tail = 0;
+    q->last_write = 0;
+    q->count = 0;
+}
+
+/**
+ * @brief  To add an operation to the end of the queue
+ * @note   Fill dev, mem_address, data, datasize, kind and complete first.
+ * @param  *q: Address of the queue instance
+ * @param  *op: Address of the operation
+ * @return EEPROM_OK if queued, EEPROM_ERROR on bad arguments
+ */
+eeprom_status eeprom_submit(eeprom_queue *q, eeprom_op *op) {
+    if (op->dev->geometry.page_size == 0 || op->datasize == 0) {
+        op->status = EEPROM_ERROR;
+        return EEPROM_ERROR;
+    }
+    op->done = 0;
+    op->status = EEPROM_BUSY;
+    op->polls = 0;
+    op->next = 0;
+    if (q->tail) {
+        q->tail->next = op;
+    } else {
+        q->head = op;
+    }
+    q->tail = op;
+    ++q->count;
+    return EEPROM_OK;
+}
+
+/**
+ * @brief  To queue a read
+ * @param  *q: Address of the queue instance
+ * @param  *op: Address of the operation
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @return EEPROM_OK if queued, EEPROM_ERROR on bad arguments
+ */
+eeprom_status eeprom_submit_read(eeprom_queue *q, eeprom_op *op, eeprom *a, uint32_t mem_address, uint8_t *data, uint16_t datasize) {
+    op->dev = a;
+    op->mem_address = mem_address;
+    op->data = data;
+    op->datasize = datasize;
+    op->kind = EEPROM_OP_READ;
+    op->complete = 0;
+    return eeprom_submit(q, op);
+}
+
+/**
+ * @brief  To queue a write
+ * @param  *q: Address of the queue instance
+ * @param  *op: Address of the operation
+ * @param  *a: Address of the EEPROM instance
+ * @param  mem_address: Starting address
+ * @param  *data: Data Array
+ * @param  datasize: Size of the data array
+ * @return EEPROM_OK if queued, EEPROM_ERROR on bad arguments
+ */
+eeprom_status eeprom_submit_write(eeprom_queue *q, eeprom_op *op, eeprom *a, uint32_t mem_address, const uint8_t *data, uint16_t datasize) {
+    op->dev = a;
+    op->mem_address = mem_address;
+    op->data = (uint8_t *) data;
+    op->datasize = datasize;
+    op->kind = EEPROM_OP_WRITE;
+    op->complete = 0;
+    return eeprom_submit(q, op);
+}
+
+/**
+ * @brief  To take a finished operation out of the queue
+ * @param  *q: Address of the queue instance
+ * @param  *prev: Entry before it, NULL for the head
+ * @param  *op: Address of the operation
+ * @param  status: Final status of the operation
+ * @return None
+ */
+static void eeprom_queue_remove(eeprom_queue *q, eeprom_op *prev, eeprom_op *op, eeprom_status status) {
+    if (prev) {
+        prev->next = op->next;
+    } else {
+        q->head = op->next;
+    }
+    if (q->tail == op) {
+        q->tail = prev;
+    }
+    --q->count;
+    op->status = status;
+    if (op->complete) {
+        op->complete(op);
+    }
+}
+
+/**
+ * @brief  Newest pending byte of an address from a list of writes
+ * @param  *w: First write to look at
+ * @param  *stop: Entry to stop at, NULL for the end of the queue
+ * @param  *a: Address of the EEPROM instance
+ * @param  address: Memory address
+ * @param  *byte: Set to the pending byte
+ * @return 1 if a write still holds the address, 0 if not
+ */
+static uint8_t eeprom_queue_pending(eeprom_op *w, eeprom_op *stop, eeprom *a, uint32_t address, uint8_t *byte) {
+    uint8_t found = 0;
+
+    for (; w != stop; w = w->next) {
+        if (w->kind == EEPROM_OP_WRITE && w->dev == a
+            && address >= w->mem_address + w->done && address < w->mem_address + w->datasize) {
+            *byte = w->data[address - w->mem_address];                              // later writes win
+            found = 1;
+        }
+    }
+    return found;
+}
+
+/**
+ * @brief  To serve a read, laying earlier pending writes over the chip contents
+ * @param  *q: Address of the queue instance
+ * @param  *op: Address of the read
+ * @return Status of the read
+ */
+static eeprom_status eeprom_queue_read(eeprom_queue *q, eeprom_op *op) {
+    eeprom_status status;
+    uint16_t i;
+
+    for (i = 0; i < op->datasize; ++i) {
+        if (!eeprom_queue_pending(q->head, op, op->dev, op->mem_address + i, &op->data[i])) {
+            break;
+        }
+    }
+    if (i == op->datasize) {
+        return EEPROM_OK;                                                           // all of it is still queued
+    }
+    status = eeprom_read(op->dev, op->mem_address, op->data, op->datasize);
+    if (status != EEPROM_OK) {
+        return status;
+    }
+    for (i = 0; i < op->datasize; ++i) {
+        eeprom_queue_pending(q->head, op, op->dev, op->mem_address + i, &op->data[i]);
+    }
+    return EEPROM_OK;
+}
+
+/**
+ * @brief  Producer for eeprom_write_cb() over the merged writes
+ * @param  *context: Address of the merge set
+ * @return Next byte of the page write
+ */
+static uint8_t eeprom_merge_next(void *context) {
+    eeprom_merge *m = (eeprom_merge *) context;
+    uint32_t address = m->address++;
+    eeprom_op *w;
+    uint8_t i = m->count;
+
+    while (i-- > 1) {
+        w = m->ops[i];
+        if (address >= w->mem_address + w->done && address < w->mem_address + w->datasize) {
+            return w->data[address - w->mem_address];
+        }
+    }
+    return m->ops[0]->data[address - m->ops[0]->mem_address];
+}
+
+/**
+ * @brief  To write the next page of a write, merging later writes to the same page
+ * @note   If the page write fails every write merged into it fails with it.
+ * @param  *q: Address of the queue instance
+ * @param  *op: Oldest write of its chip
+ * @return None
+ */
+static void eeprom_queue_write(eeprom_queue *q, eeprom_op *op) {
+    eeprom *a = op->dev;
+    uint16_t page_size = a->geometry.page_size;
+    uint32_t page = (op->mem_address + op->done) & ~(uint32_t) (page_size - 1);
+    uint32_t page_end = page + page_size;
+    uint32_t low = op->mem_address + op->done;
+    uint32_t high = op->mem_address + op->datasize;
+    uint32_t start, end;
+    eeprom_status status;
+    eeprom_merge m;
+    eeprom_op *w;
+    uint8_t i;
+
+    if (high > page_end) {
+        high = page_end;
+    }
+    m.ops[0] = op;
+    m.count = 1;
+    for (w = op->next; w && m.count < EEPROM_QUEUE_MERGE; w = w->next) {
+        if (w->kind != EEPROM_OP_WRITE || w->dev != a) {
+            continue;
+        }
+        start = w->mem_address + w->done;
+        end = w->mem_address + w->datasize;
+        if (end <= page || start >= page_end) {
+            continue;                                                               // another page
+        }
+        if (start < page || start > high || end < low) {
+            break;                                                                  // merging would reorder the writes
+        }
+        if (start < low) {
+            low = start;
+        }
+        if (end > high) {
+            high = (end < page_end) ? end : page_end;
+        }
+        m.ops[m.count++] = w;
+    }
+
+    m.address = low;
+    status = eeprom_write_cb(a, low, eeprom_merge_next, &m, (uint16_t) (high - low));
+    q->last_write = a;
+
+    for (i = 0; i < m.count; ++i) {
+        w = m.ops[i];
+        if (status != EEPROM_OK) {
+            w->status = status;                                                     // taken out with the finished ones
+            continue;
+        }
+        end = w->mem_address + w->datasize;
+        w->done = (uint16_t) (((end < high) ? end : high) - w->mem_address);
+    }
+}
+
+/**
+ * @brief  Whether the chip of an operation may be accessed
+ * @note   Only polls that reach the bus count against the poll budget of the chip, a write
+ *         cycle timed by eeprom_set_write_time() does not.
+ * @param  *op: Address of the operation
+ * @return EEPROM_OK if ready, EEPROM_BUSY if not, EEPROM_TIMEOUT once the budget is spent
+ */
+static eeprom_status eeprom_queue_poll(eeprom_op *op) {
+    eeprom *a = op->dev;
+
+    if (eeprom_is_ready(a)) {
+        op->polls = 0;
+        return EEPROM_OK;
+    }
+    if (a->write_time == 0 || !eeprom_tick) {
+        ++op->polls;
+    }
+    return (a->poll_limit != 0 && op->polls >= a->poll_limit) ? EEPROM_TIMEOUT : EEPROM_BUSY;
+}
+
+/**
+ * @brief  Whether a write may go to the bus
+ * @note   Only the oldest write of a chip may, and none while a read of the chip is queued,
+ *         so a read never sees data written after it was submitted.
+ * @param  *q: Address of the queue instance
+ * @param  *op: Address of the write
+ * @return 1 if it may, 0 if not
+ */
+static uint8_t eeprom_queue_eligible(eeprom_queue *q, eeprom_op *op) {
+    uint8_t older = 1;
+    eeprom_op *w;
+
+    for (w = q->head; w; w = w->next) {
+        if (w == op) {
+            older = 0;
+        } else if (w->dev == op->dev && (w->kind == EEPROM_OP_READ || older)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief  To perform one transaction of the queue
+ * @note   Returns without touching the bus if every queued chip is in its write cycle.
+ *         An operation whose chip stays busy for longer than its poll budget, set with
+ *         eeprom_set_timeout(), is finished with EEPROM_TIMEOUT.
+ * @param  *q: Address of the queue instance
+ * @return Number of operations still queued
+ */
+uint8_t eeprom_queue_run(eeprom_queue *q) {
+    eeprom_op *op, *prev, *next, *pick = 0;
+    eeprom_status ready;
+
+    for (prev = 0, op = q->head; op; prev = op, op = op->next) {
+        if (op->kind != EEPROM_OP_READ) {
+            continue;
+        }
+        ready = eeprom_queue_poll(op);
+        if (ready == EEPROM_OK) {
+            eeprom_queue_remove(q, prev, op, eeprom_queue_read(q, op));
+            return q->count;
+        }
+        if (ready == EEPROM_TIMEOUT) {
+            eeprom_queue_remove(q, prev, op, EEPROM_TIMEOUT);
+            return q->count;
+        }
+    }
+    for (op = q->head; op; op = op->next) {
+        if (op->kind != EEPROM_OP_WRITE || (pick && op->dev == q->last_write) || !eeprom_queue_eligible(q, op)) {
+            continue;
+        }
+        ready = eeprom_queue_poll(op);
+        if (ready == EEPROM_OK) {
+            pick = op;
+            if (op->dev != q->last_write) {
+                break;                                                              // another chip than the last write
+            }
+        } else if (ready == EEPROM_TIMEOUT) {
+            op->status = EEPROM_TIMEOUT;
+        }
+    }
+    if (pick) {
+        eeprom_queue_write(q, pick);
+    }
+    for (prev = 0, op = q->head; op; op = next) {
+        next = op->next;
+        if (op->status != EEPROM_BUSY) {
+            eeprom_queue_remove(q, prev, op, op->status);                           // failed
+        } else if (op->kind == EEPROM_OP_WRITE && op->done == op->datasize) {
+            eeprom_queue_remove(q, prev, op, EEPROM_OK);                            // finished, possibly by merging
+        } else {
+            prev = op;
+        }
+    }
+    return q->count;
+}
+
+/**
+ * @brief  To run the queue until it is empty
+ * @param  *q: Address of the queue instance
+ * @return None
+ */
+void eeprom_queue_drain(eeprom_queue *q) {
+    while (eeprom_queue_run(q));
+}
+
+#endif
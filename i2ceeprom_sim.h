@@ -0,0 +1,313 @@
+/**
+ * @file
+ * @code #define EEPROM_BUS EEPROM_BUS_SIM
+ * #include "i2ceeprom.h"
+ * @endcode
+ *
+ * @brief Host simulation of 24CXX EEPROMs on an I2C bus.
+ *
+ * Implements the i2cmaster API the library calls on top of simulated devices of
+ * any supported size, so the library runs on a PC. The model covers:
+ *  - block-select bits in the device address (A8-A10, A16),
+ *  - the page buffer, which rolls over inside a page, and the commit on STOP,
+ *  - NACKs on the device address during the write cycle, for ACK polling,
+ *  - the time each START, byte and STOP takes at the chosen bus speed.
+ *
+ * Counters give transaction counts and an estimate of wall time, and
+ * eeprom_sim_tick() can be handed to eeprom_set_tick() as a tick source.
+ * The TWI registers are not modelled, so EEPROM_ASYNC cannot be simulated.
+ *
+ * @par Usage Example:
+ *
+ * @code
+ * #define EEPROM_BUS EEPROM_BUS_SIM
+ * #include "i2ceeprom.h"
+ *
+ * eeprom_sim_attach(0xA0, 256);                       // a 24C256 with E2..E0 low
+ * eeprom_sim_set_speed(400);
+ *
+ * eeprom eep;
+ * eeprom_init(&eep, 0xA0, 256);
+ * eeprom_write(&eep, 0x10, data, sizeof data);
+ * printf("%lu us\n", (unsigned long) (eeprom_sim_stats.time_ns / 1000));
+ * @endcode
+ */
+
+#ifndef I2CEEPROM_SIM_H
+#define I2CEEPROM_SIM_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define I2C_READ                1
+#define I2C_WRITE               0
+
+#ifndef EEPROM_SIM_DEVICES
+#define EEPROM_SIM_DEVICES      8
+#endif
+
+/**
+ * @brief  Bus activity seen by the simulator
+ */
+typedef struct eeprom_sim_counters {
+    uint32_t starts;                        // START and repeated START conditions
+    uint32_t stops;                         // STOP conditions
+    uint32_t nacks;                         // Addressing attempts that were not acknowledged
+    uint32_t bytes_written;                 // Bytes sent by the master, addresses included
+    uint32_t bytes_read;                    // Bytes sent by the devices
+    uint32_t page_writes;                   // Write cycles started by the devices
+    uint64_t time_ns;                       // Simulated time
+}eeprom_sim_counters;
+
+/**
+ * @brief  One simulated EEPROM
+ */
+typedef struct eeprom_sim_device {
+    uint8_t *memory;
+    uint32_t size;                          // Size in bytes
+    uint32_t pointer;                       // Internal address counter
+    uint64_t busy_until;                    // End of the write cycle in progress
+    uint16_t page_size;
+    uint8_t address;                        // Device address with the block bits clear
+    uint8_t block_mask;
+    uint8_t addr_bytes;
+    uint8_t page_dirty;                     // Page buffer holds data to commit on STOP
+    uint8_t page[256];                      // Page buffer
+    uint8_t page_loaded[256];               // Bytes of the page buffer written in this transfer
+}eeprom_sim_device;
+
+enum {
+    EEPROM_SIM_IDLE = 0,
+    EEPROM_SIM_ADDRESS,                     // Receiving memory address bytes
+    EEPROM_SIM_WRITE,                       // Receiving data
+    EEPROM_SIM_READ                         // Sending data
+};
+
+static eeprom_sim_device eeprom_sim_devices[EEPROM_SIM_DEVICES];
+static uint8_t eeprom_sim_count;
+static eeprom_sim_device *eeprom_sim_active;                                        // Device addressed by the current transfer
+static uint8_t eeprom_sim_state;
+static uint8_t eeprom_sim_address_left;                                             // Memory address bytes still to come
+static uint8_t eeprom_sim_in_transfer;                                              // Bus is between START and STOP
+static uint32_t eeprom_sim_bit_ns = 10000;                                          // 100 kHz
+static uint32_t eeprom_sim_write_ns = 5000000;                                      // 5 ms tWR
+eeprom_sim_counters eeprom_sim_stats;
+
+/**
+ * @brief  To add a simulated EEPROM to the bus
+ * @note   The memory starts erased to 0xFF.
+ * @param  dev_address: I2C address as passed to eeprom_init()
+ * @param  size: Size of the EEPROM in Kbits
+ * @return Pointer to the memory of the device, NULL if it cannot be added
+ */
+uint8_t *eeprom_sim_attach(uint8_t dev_address, uint16_t size) {
+    eeprom_sim_device *d;
+
+    if (eeprom_sim_count == EEPROM_SIM_DEVICES || !EEPROM_GEOM_VALID(size)) {
+        return 0;
+    }
+    d = &eeprom_sim_devices[eeprom_sim_count];
+    d->size = (uint32_t) size * 128;
+    d->memory = (uint8_t *) malloc(d->size);
+    if (!d->memory) {
+        return 0;
+    }
+    memset(d->memory, 0xFF, d->size);
+    d->page_size = EEPROM_GEOM_PAGE_SIZE(size);
+    d->block_mask = EEPROM_GEOM_BLOCK_MASK(size);
+    d->addr_bytes = EEPROM_GEOM_ADDR_BYTES(size);
+    d->address = dev_address & 0xFE & (uint8_t) ~d->block_mask;
+    d->pointer = 0;
+    d->busy_until = 0;
+    d->page_dirty = 0;
+    ++eeprom_sim_count;
+    return d->memory;
+}
+
+/**
+ * @brief  To remove all simulated EEPROMs and clear the counters
+ * @return None
+ */
+void eeprom_sim_reset(void) {
+    for (uint8_t i = 0; i < eeprom_sim_count; ++i) {
+        free(eeprom_sim_devices[i].memory);
+    }
+    eeprom_sim_count = 0;
+    eeprom_sim_active = 0;
+    eeprom_sim_state = EEPROM_SIM_IDLE;
+    eeprom_sim_in_transfer = 0;
+    memset(&eeprom_sim_stats, 0, sizeof eeprom_sim_stats);
+}
+
+/**
+ * @brief  To set the simulated SCL frequency
+ * @param  speed_khz: Bus speed in kHz
+ * @return None
+ */
+void eeprom_sim_set_speed(uint16_t speed_khz) {
+    eeprom_sim_bit_ns = 1000000UL / speed_khz;
+}
+
+/**
+ * @brief  To set the write cycle time of the simulated EEPROMs
+ * @param  microseconds: tWR
+ * @return None
+ */
+void eeprom_sim_set_write_time(uint32_t microseconds) {
+    eeprom_sim_write_ns = microseconds * 1000UL;
+}
+
+/**
+ * @brief  Tick source in microseconds of simulated time
+ * @note   Each call also lets 1 us pass, standing in for the CPU time of a polling loop.
+ * @return Microseconds, wrapping at 16 bits
+ */
+uint16_t eeprom_sim_tick(void) {
+    eeprom_sim_stats.time_ns += 1000;
+    return (uint16_t) (eeprom_sim_stats.time_ns / 1000);
+}
+
+/**
+ * @brief  Commit the page buffer of the active device
+ * @return None
+ */
+static void eeprom_sim_commit(void) {
+    eeprom_sim_device *d = eeprom_sim_active;
+    uint32_t base;
+
+    if (!d || !d->page_dirty) {
+        return;
+    }
+    base = d->pointer & ~(uint32_t) (d->page_size - 1);
+    for (uint16_t i = 0; i < d->page_size; ++i) {
+        if (d->page_loaded[i]) {
+            d->memory[base + i] = d->page[i];
+        }
+    }
+    d->page_dirty = 0;
+    d->busy_until = eeprom_sim_stats.time_ns + eeprom_sim_write_ns;
+    ++eeprom_sim_stats.page_writes;
+}
+
+void i2c_init(void) {
+}
+
+void i2c_stop(void) {
+    eeprom_sim_stats.time_ns += 2 * eeprom_sim_bit_ns;                               // STOP, then bus free time
+    ++eeprom_sim_stats.stops;
+    if (eeprom_sim_state == EEPROM_SIM_WRITE) {
+        eeprom_sim_commit();                                                        // the write cycle starts on STOP
+    }
+    eeprom_sim_state = EEPROM_SIM_IDLE;
+    eeprom_sim_active = 0;
+    eeprom_sim_in_transfer = 0;
+}
+
+unsigned char i2c_start(unsigned char address) {
+    eeprom_sim_device *d = 0;
+
+    if (eeprom_sim_state == EEPROM_SIM_WRITE && eeprom_sim_active) {
+        eeprom_sim_active->page_dirty = 0;                                          // a repeated START aborts the write
+    }
+    eeprom_sim_stats.time_ns += eeprom_sim_bit_ns + 9 * eeprom_sim_bit_ns;          // START and the address byte
+    ++eeprom_sim_stats.starts;
+    ++eeprom_sim_stats.bytes_written;
+    eeprom_sim_in_transfer = 1;
+    eeprom_sim_state = EEPROM_SIM_IDLE;
+    eeprom_sim_active = 0;
+
+    for (uint8_t i = 0; i < eeprom_sim_count; ++i) {
+        if ((address & 0xFE & (uint8_t) ~eeprom_sim_devices[i].block_mask) == eeprom_sim_devices[i].address) {
+            d = &eeprom_sim_devices[i];
+            break;
+        }
+    }
+    if (!d || d->busy_until > eeprom_sim_stats.time_ns) {
+        ++eeprom_sim_stats.nacks;                                                   // no such device, or in its write cycle
+        return 1;
+    }
+
+    eeprom_sim_active = d;
+    if (address & I2C_READ) {
+        eeprom_sim_state = EEPROM_SIM_READ;
+    } else {
+        // the block bits are the top of the new address
+        d->pointer = (uint32_t) ((address & d->block_mask) >> 1) << (8 * d->addr_bytes);
+        eeprom_sim_address_left = d->addr_bytes;
+        eeprom_sim_state = EEPROM_SIM_ADDRESS;
+    }
+    return 0;
+}
+
+unsigned char i2c_rep_start(unsigned char address) {
+    return i2c_start(address);
+}
+
+void i2c_start_wait(unsigned char address) {
+    while (i2c_start(address)) {
+        i2c_stop();
+    }
+}
+
+unsigned char i2c_write(unsigned char data) {
+    eeprom_sim_device *d = eeprom_sim_active;
+    uint16_t offset;
+
+    eeprom_sim_stats.time_ns += 9 * eeprom_sim_bit_ns;
+    ++eeprom_sim_stats.bytes_written;
+    if (!d) {
+        return 1;
+    }
+    switch (eeprom_sim_state) {
+    case EEPROM_SIM_ADDRESS:
+        --eeprom_sim_address_left;
+        d->pointer |= (uint32_t) data << (8 * eeprom_sim_address_left);
+        if (eeprom_sim_address_left == 0) {
+            d->pointer %= d->size;
+            memset(d->page_loaded, 0, sizeof d->page_loaded);
+            eeprom_sim_state = EEPROM_SIM_WRITE;
+        }
+        return 0;
+    case EEPROM_SIM_WRITE:
+        offset = (uint16_t) (d->pointer & (d->page_size - 1));
+        d->page[offset] = data;
+        d->page_loaded[offset] = 1;
+        d->page_dirty = 1;
+        // the address counter rolls over inside the page
+        d->pointer = (d->pointer & ~(uint32_t) (d->page_size - 1)) | ((offset + 1) & (d->page_size - 1));
+        return 0;
+    default:
+        return 1;
+    }
+}
+
+/**
+ * @brief  Clock a byte out of the active device
+ * @return Byte read, 0xFF if no device is sending
+ */
+static unsigned char eeprom_sim_read(void) {
+    eeprom_sim_device *d = eeprom_sim_active;
+    uint8_t data;
+
+    eeprom_sim_stats.time_ns += 9 * eeprom_sim_bit_ns;
+    if (!d || eeprom_sim_state != EEPROM_SIM_READ) {
+        return 0xFF;
+    }
+    ++eeprom_sim_stats.bytes_read;
+    data = d->memory[d->pointer];
+    d->pointer = (d->pointer + 1) % d->size;                                         // sequential reads roll over the whole part
+    return data;
+}
+
+unsigned char i2c_readAck(void) {
+    return eeprom_sim_read();
+}
+
+unsigned char i2c_readNak(void) {
+    return eeprom_sim_read();
+}
+
+#define i2c_read(ack)           (ack) ? i2c_readAck() : i2c_readNak();
+
+#endif
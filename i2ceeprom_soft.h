@@ -0,0 +1,164 @@
+/**
+ * @file
+ * @code #define EEPROM_BUS EEPROM_BUS_SOFT
+ * #include "i2ceeprom.h"
+ * @endcode
+ *
+ * @brief Bit-banged I2C master on any two GPIO pins.
+ *
+ * Implements the i2cmaster API the library calls, for parts or pins without a TWI.
+ * The lines are driven open drain: a line is pulled low by making its pin an output
+ * with the PORT bit cleared, and released by making it an input again, so external
+ * pull-ups are required. SCL is read back after every release, which honours clock
+ * stretching.
+ *
+ * The primitives are static inline, and with the pins in the low I/O space every line
+ * change is a single sbi/cbi. EEPROM_BUS_FAST selects the timing of 400 kHz (default)
+ * or 100 kHz parts, the actual rate is somewhat lower because of the instruction time.
+ *
+ * Select the pins before including, the defaults are the TWI pins of the ATmega328P:
+ * @code
+ * #define EEPROM_SOFT_DDR     DDRB
+ * #define EEPROM_SOFT_PORT    PORTB
+ * #define EEPROM_SOFT_PIN     PINB
+ * #define EEPROM_SOFT_SDA     PB0
+ * #define EEPROM_SOFT_SCL     PB1
+ * #define EEPROM_BUS          EEPROM_BUS_SOFT
+ * #include "i2ceeprom.h"
+ * @endcode
+ */
+
+#ifndef I2CEEPROM_SOFT_H
+#define I2CEEPROM_SOFT_H
+
+#include <avr/io.h>
+#include <util/delay.h>
+
+#define I2C_READ                1
+#define I2C_WRITE               0
+
+#ifndef EEPROM_SOFT_DDR
+#define EEPROM_SOFT_DDR         DDRC
+#define EEPROM_SOFT_PORT        PORTC
+#define EEPROM_SOFT_PIN         PINC
+#define EEPROM_SOFT_SDA         PC4
+#define EEPROM_SOFT_SCL         PC5
+#endif
+
+#ifndef EEPROM_BUS_FAST
+#define EEPROM_BUS_FAST         1
+#endif
+#if EEPROM_BUS_FAST
+#define EEPROM_SOFT_T_LOW       1.3     // SCL low, us
+#define EEPROM_SOFT_T_HIGH      0.6     // SCL high, START/STOP setup and hold, us
+#else
+#define EEPROM_SOFT_T_LOW       4.7
+#define EEPROM_SOFT_T_HIGH      4.0
+#endif
+
+#define EEPROM_SOFT_LOW(bit)    (EEPROM_SOFT_DDR |= (1 << (bit)))
+#define EEPROM_SOFT_RELEASE(bit) (EEPROM_SOFT_DDR &= ~(1 << (bit)))
+#define EEPROM_SOFT_READ(bit)   (EEPROM_SOFT_PIN & (1 << (bit)))
+
+/**
+ * @brief  Release SCL and wait for it to go high
+ * @return None
+ */
+static inline void eeprom_soft_scl_high(void) {
+    EEPROM_SOFT_RELEASE(EEPROM_SOFT_SCL);
+    while (!EEPROM_SOFT_READ(EEPROM_SOFT_SCL));                                    // the slave may stretch the clock
+}
+
+/**
+ * @brief  One clock pulse, sampling SDA while SCL is high
+ * @return SDA level
+ */
+static inline uint8_t eeprom_soft_clock(void) {
+    uint8_t level;
+
+    _delay_us(EEPROM_SOFT_T_LOW);
+    eeprom_soft_scl_high();
+    _delay_us(EEPROM_SOFT_T_HIGH);
+    level = EEPROM_SOFT_READ(EEPROM_SOFT_SDA) ? 1 : 0;
+    EEPROM_SOFT_LOW(EEPROM_SOFT_SCL);
+    return level;
+}
+
+static inline void i2c_init(void) {
+    EEPROM_SOFT_PORT &= ~((1 << EEPROM_SOFT_SDA) | (1 << EEPROM_SOFT_SCL));      // pins only ever pull low
+    EEPROM_SOFT_RELEASE(EEPROM_SOFT_SDA);
+    EEPROM_SOFT_RELEASE(EEPROM_SOFT_SCL);
+}
+
+static inline void i2c_stop(void) {
+    EEPROM_SOFT_LOW(EEPROM_SOFT_SDA);
+    _delay_us(EEPROM_SOFT_T_LOW);
+    eeprom_soft_scl_high();
+    _delay_us(EEPROM_SOFT_T_HIGH);
+    EEPROM_SOFT_RELEASE(EEPROM_SOFT_SDA);                                           // SDA rises while SCL is high
+    _delay_us(EEPROM_SOFT_T_LOW);                                                   // bus free time
+}
+
+static inline unsigned char i2c_write(unsigned char data) {
+    for (uint8_t mask = 0x80; mask != 0; mask >>= 1) {
+        if (data & mask) {
+            EEPROM_SOFT_RELEASE(EEPROM_SOFT_SDA);
+        } else {
+            EEPROM_SOFT_LOW(EEPROM_SOFT_SDA);
+        }
+        eeprom_soft_clock();
+    }
+    EEPROM_SOFT_RELEASE(EEPROM_SOFT_SDA);
+    return eeprom_soft_clock();                                                     // 0 on ACK, 1 on NACK
+}
+
+static inline unsigned char i2c_start(unsigned char address) {
+    EEPROM_SOFT_RELEASE(EEPROM_SOFT_SDA);                                           // also a repeated START after SCL low
+    _delay_us(EEPROM_SOFT_T_LOW);
+    eeprom_soft_scl_high();
+    _delay_us(EEPROM_SOFT_T_HIGH);
+    EEPROM_SOFT_LOW(EEPROM_SOFT_SDA);                                               // SDA falls while SCL is high
+    _delay_us(EEPROM_SOFT_T_HIGH);
+    EEPROM_SOFT_LOW(EEPROM_SOFT_SCL);
+    return i2c_write(address);
+}
+
+static inline unsigned char i2c_rep_start(unsigned char address) {
+    return i2c_start(address);
+}
+
+static inline void i2c_start_wait(unsigned char address) {
+    while (i2c_start(address)) {
+        i2c_stop();                                                                 // device busy, try again
+    }
+}
+
+/**
+ * @brief  Read a byte and send the acknowledge bit
+ * @param  nack: 0 to ACK, 1 to NAK the byte
+ * @return Byte read
+ */
+static inline unsigned char eeprom_soft_read(uint8_t nack) {
+    uint8_t data = 0;
+
+    EEPROM_SOFT_RELEASE(EEPROM_SOFT_SDA);
+    for (uint8_t i = 0; i < 8; ++i) {
+        data = (uint8_t) (data << 1) | eeprom_soft_clock();
+    }
+    if (!nack) {
+        EEPROM_SOFT_LOW(EEPROM_SOFT_SDA);
+    }
+    eeprom_soft_clock();
+    EEPROM_SOFT_RELEASE(EEPROM_SOFT_SDA);
+    return data;
+}
+
+static inline unsigned char i2c_readAck(void) {
+    return eeprom_soft_read(0);
+}
+
+static inline unsigned char i2c_readNak(void) {
+    return eeprom_soft_read(1);
+}
+
+#endif
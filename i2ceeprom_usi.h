@@ -0,0 +1,157 @@
+/**
+ * @file
+ * @code #define EEPROM_BUS EEPROM_BUS_USI
+ * #include "i2ceeprom.h"
+ * @endcode
+ *
+ * @brief I2C master on the USI of ATtiny parts.
+ *
+ * Implements the i2cmaster API the library calls on the Universal Serial Interface in
+ * two-wire mode, following Atmel application note AVR310. The USI shifts the data and
+ * holds SDA, the software strobes SCL and times the bus with _delay_us(). SCL is read
+ * back after every rising edge, which honours clock stretching.
+ *
+ * The primitives are static inline. EEPROM_BUS_FAST selects the timing of 400 kHz
+ * (default) or 100 kHz parts.
+ *
+ * The defaults match the ATtiny25/45/85. Other parts put the USI on other pins, for
+ * example the ATtiny24/44/84:
+ * @code
+ * #define EEPROM_USI_DDR      DDRA
+ * #define EEPROM_USI_PORT     PORTA
+ * #define EEPROM_USI_PIN      PINA
+ * #define EEPROM_USI_SDA      PA6
+ * #define EEPROM_USI_SCL      PA4
+ * #define EEPROM_BUS          EEPROM_BUS_USI
+ * #include "i2ceeprom.h"
+ * @endcode
+ */
+
+#ifndef I2CEEPROM_USI_H
+#define I2CEEPROM_USI_H
+
+#include <avr/io.h>
+#include <util/delay.h>
+
+#define I2C_READ                1
+#define I2C_WRITE               0
+
+#ifndef EEPROM_USI_DDR
+#define EEPROM_USI_DDR          DDRB
+#define EEPROM_USI_PORT         PORTB
+#define EEPROM_USI_PIN          PINB
+#define EEPROM_USI_SDA          PB0
+#define EEPROM_USI_SCL          PB2
+#endif
+
+#ifndef EEPROM_BUS_FAST
+#define EEPROM_BUS_FAST         1
+#endif
+#if EEPROM_BUS_FAST
+#define EEPROM_USI_T_LOW        1.3     // SCL low, us
+#define EEPROM_USI_T_HIGH       0.6     // SCL high, START/STOP setup and hold, us
+#else
+#define EEPROM_USI_T_LOW        4.7
+#define EEPROM_USI_T_HIGH       4.0
+#endif
+
+// Two-wire mode, software clock strobe, with or without toggling SCL
+#define EEPROM_USICR            ((1 << USIWM1) | (1 << USICS1) | (1 << USICLK))
+#define EEPROM_USICR_STROBE     (EEPROM_USICR | (1 << USITC))
+// Clear the flags and count 16 edges (8 bits) or 2 edges (1 bit)
+#define EEPROM_USISR_8BIT       ((1 << USISIF) | (1 << USIOIF) | (1 << USIPF) | (1 << USIDC) | (0x0 << USICNT0))
+#define EEPROM_USISR_1BIT       ((1 << USISIF) | (1 << USIOIF) | (1 << USIPF) | (1 << USIDC) | (0xE << USICNT0))
+
+/**
+ * @brief  Clock bits through the USI data register
+ * @param  status: EEPROM_USISR_8BIT or EEPROM_USISR_1BIT
+ * @return Contents of the data register, the bits sampled from SDA
+ */
+static inline uint8_t eeprom_usi_transfer(uint8_t status) {
+    uint8_t data;
+
+    USISR = status;
+    do {
+        _delay_us(EEPROM_USI_T_LOW);
+        USICR = EEPROM_USICR_STROBE;                                                // rising SCL edge
+        while (!(EEPROM_USI_PIN & (1 << EEPROM_USI_SCL)));                         // the slave may stretch the clock
+        _delay_us(EEPROM_USI_T_HIGH);
+        USICR = EEPROM_USICR_STROBE;                                                // falling SCL edge
+    } while (!(USISR & (1 << USIOIF)));
+    _delay_us(EEPROM_USI_T_LOW);
+    data = USIDR;
+    USIDR = 0xFF;                                                                   // release SDA
+    EEPROM_USI_DDR |= (1 << EEPROM_USI_SDA);
+    return data;
+}
+
+static inline void i2c_init(void) {
+    EEPROM_USI_PORT |= (1 << EEPROM_USI_SDA) | (1 << EEPROM_USI_SCL);
+    EEPROM_USI_DDR |= (1 << EEPROM_USI_SDA) | (1 << EEPROM_USI_SCL);
+    USIDR = 0xFF;
+    USICR = EEPROM_USICR;
+    USISR = EEPROM_USISR_8BIT;
+}
+
+static inline void i2c_stop(void) {
+    EEPROM_USI_PORT &= ~(1 << EEPROM_USI_SDA);
+    EEPROM_USI_PORT |= (1 << EEPROM_USI_SCL);
+    while (!(EEPROM_USI_PIN & (1 << EEPROM_USI_SCL)));
+    _delay_us(EEPROM_USI_T_HIGH);
+    EEPROM_USI_PORT |= (1 << EEPROM_USI_SDA);                                       // SDA rises while SCL is high
+    _delay_us(EEPROM_USI_T_LOW);                                                    // bus free time
+}
+
+static inline unsigned char i2c_write(unsigned char data) {
+    EEPROM_USI_PORT &= ~(1 << EEPROM_USI_SCL);
+    USIDR = data;
+    eeprom_usi_transfer(EEPROM_USISR_8BIT);
+    EEPROM_USI_DDR &= ~(1 << EEPROM_USI_SDA);                                       // let the slave drive the ACK
+    return eeprom_usi_transfer(EEPROM_USISR_1BIT) & 0x01;                          // 0 on ACK, 1 on NACK
+}
+
+static inline unsigned char i2c_start(unsigned char address) {
+    EEPROM_USI_PORT |= (1 << EEPROM_USI_SCL);                                       // also a repeated START after SCL low
+    while (!(EEPROM_USI_PIN & (1 << EEPROM_USI_SCL)));
+    _delay_us(EEPROM_USI_T_HIGH);
+    EEPROM_USI_PORT &= ~(1 << EEPROM_USI_SDA);                                      // SDA falls while SCL is high
+    _delay_us(EEPROM_USI_T_HIGH);
+    EEPROM_USI_PORT &= ~(1 << EEPROM_USI_SCL);
+    EEPROM_USI_PORT |= (1 << EEPROM_USI_SDA);                                       // the USI holds SDA from here
+    return i2c_write(address);
+}
+
+static inline unsigned char i2c_rep_start(unsigned char address) {
+    return i2c_start(address);
+}
+
+static inline void i2c_start_wait(unsigned char address) {
+    while (i2c_start(address)) {
+        i2c_stop();                                                                 // device busy, try again
+    }
+}
+
+/**
+ * @brief  Read a byte and send the acknowledge bit
+ * @param  nack: 0 to ACK, 1 to NAK the byte
+ * @return Byte read
+ */
+static inline unsigned char eeprom_usi_read(uint8_t nack) {
+    uint8_t data;
+
+    EEPROM_USI_DDR &= ~(1 << EEPROM_USI_SDA);
+    data = eeprom_usi_transfer(EEPROM_USISR_8BIT);
+    USIDR = nack ? 0xFF : 0x00;
+    eeprom_usi_transfer(EEPROM_USISR_1BIT);
+    return data;
+}
+
+static inline unsigned char i2c_readAck(void) {
+    return eeprom_usi_read(0);
+}
+
+static inline unsigned char i2c_readNak(void) {
+    return eeprom_usi_read(1);
+}
+
+#endif
@@ -0,0 +1,226 @@
+/**
+ * @file
+ * @brief Host test of the library against the simulated bus.
+ *
+ * Every check compares what the library returns with a shadow copy and with the
+ * memory of the simulated part, so a stale cache line or read-ahead byte shows up
+ * even when the data read back looks right:
+ *  - random:       eeprom_write() and eeprom_read() of random spans on every size class
+ *  - direct:       EEPROM_DEFINE() writes, which go past the cache, between cached accesses
+ *  - update/fill:  eeprom_update(), eeprom_fill_update() and eeprom_verify()
+ *  - log:          eeprom_log_sync() puts the records on the chip
+ *  - kv:           eeprom_kv_put() survives compaction and reopening
+ *
+ * Build it once per configuration of the cache and the read-ahead buffer, it prints
+ * the failing checks and returns nonzero if there was any:
+ *
+ * @code
+ * cc -O2 -I.. sim_test.c -o sim_test && ./sim_test
+ * cc -O2 -I.. -DEEPROM_CACHE_PAGES=4 sim_test.c -o sim_test && ./sim_test
+ * cc -O2 -I.. -DEEPROM_READAHEAD=32 sim_test.c -o sim_test && ./sim_test
+ * @endcode
+ */
+#define EEPROM_BUS          EEPROM_BUS_SIM
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "i2ceeprom_log.h"
+#include "i2ceeprom_kv.h"
+
+#define TEST_ADDRESS        0xA0
+#define TEST_OPS            400             // random operations per size class
+#define TEST_MAX_SPAN       100             // longest random transfer
+
+#define CHECK(cond, ...) do {                                                       \
+        if (!(cond)) {                                                              \
+            printf("FAIL %s:%d: ", __func__, __LINE__);                             \
+            printf(__VA_ARGS__);                                                    \
+            printf("\n");                                                           \
+            ++test_failures;                                                        \
+        }                                                                           \
+    } while (0)
+
+EEPROM_DEFINE(at24c256, 256)
+
+static uint8_t test_shadow[1024UL * 128];
+static uint8_t test_data[TEST_MAX_SPAN];
+static uint16_t test_seed;
+static unsigned test_failures;
+
+static uint16_t test_random(void) {
+    test_seed = test_seed * 25173 + 13849;
+    return test_seed;
+}
+
+/**
+ * @brief  Fresh part of the given size, erased, in the shadow copy as well
+ */
+static uint8_t *test_part(eeprom *a, uint16_t kbits) {
+    uint8_t *memory;
+
+    eeprom_sim_reset();
+    memory = eeprom_sim_attach(TEST_ADDRESS, kbits);
+    eeprom_init(a, TEST_ADDRESS, kbits);
+    memset(test_shadow, 0xFF, (uint32_t) kbits * 128);
+    return memory;
+}
+
+/**
+ * @brief  Random writes and reads, checked against the shadow copy and the chip
+ */
+static void test_random_access(void) {
+    static const uint16_t sizes[] = {1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024};
+    eeprom eep;
+
+    for (uint8_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        uint32_t bytes = (uint32_t) sizes[s] * 128;
+        uint8_t *memory = test_part(&eep, sizes[s]);
+
+        test_seed = sizes[s];
+        for (uint16_t op = 0; op < TEST_OPS; ++op) {
+            uint32_t at = ((uint32_t) test_random() << 8 ^ test_random()) % bytes;
+            uint16_t n = 1 + test_random() % TEST_MAX_SPAN;
+
+            if (n > bytes - at) {
+                n = (uint16_t) (bytes - at);
+            }
+            if (test_random() & 1) {
+                for (uint16_t i = 0; i < n; ++i) {
+                    test_data[i] = (uint8_t) test_random();
+                }
+                CHECK(eeprom_write(&eep, at, test_data, n) == EEPROM_OK, "%uK write at %lu", sizes[s], (unsigned long) at);
+                memcpy(test_shadow + at, test_data, n);
+            } else {
+                CHECK(eeprom_read(&eep, at, test_data, n) == EEPROM_OK, "%uK read at %lu", sizes[s], (unsigned long) at);
+                CHECK(memcmp(test_data, test_shadow + at, n) == 0, "%uK data at %lu", sizes[s], (unsigned long) at);
+            }
+        }
+        CHECK(eeprom_flush(&eep) == EEPROM_OK, "%uK flush", sizes[s]);
+        CHECK(memcmp(memory, test_shadow, bytes) == 0, "%uK chip differs from the shadow", sizes[s]);
+    }
+}
+
+/**
+ * @brief  Accesses past the cache must not leave or see a stale copy
+ */
+static void test_direct_writes(void) {
+    eeprom eep;
+    uint8_t *memory = test_part(&eep, 256);
+    uint8_t value = 0;
+    uint32_t word = 0x12345678, back = 0;
+
+    eeprom_read(&eep, 0x10, &value, 1);                                             // cached or read ahead
+    CHECK(at24c256_byte_write(&eep, 0x10, 0x5A) == EEPROM_OK, "byte_write");
+    eeprom_read(&eep, 0x10, &value, 1);
+    CHECK(value == 0x5A, "byte_write read back %02x", value);
+
+    eeprom_read(&eep, 0x40, (uint8_t *) &back, 4);
+    CHECK(at24c256_put(&eep, 0x42, &word, 4) == EEPROM_OK, "put");
+    eeprom_read(&eep, 0x42, (uint8_t *) &back, 4);
+    CHECK(back == word, "put read back %08lx", (unsigned long) back);
+
+    value = 7;
+    eeprom_write(&eep, 0x80, &value, 1);                                            // may stay in the cache
+    value = 9;
+    CHECK(at24c256_write(&eep, 0x81, &value, 1) == EEPROM_OK, "write");
+    CHECK(memory[0x80] == 7 && memory[0x81] == 9, "chip holds %u %u", memory[0x80], memory[0x81]);
+
+    value = 0x11;
+    eeprom_write(&eep, 0xC0, &value, 1);                                            // may stay in the cache
+    value = 0;
+    CHECK(at24c256_read(&eep, 0xC0, &value, 1) == EEPROM_OK && value == 0x11, "read after write %02x", value);
+    value = 0x22;
+    eeprom_write(&eep, 0xC1, &value, 1);
+    value = 0;
+    CHECK(at24c256_byte_read(&eep, 0xC1, &value) == EEPROM_OK && value == 0x22, "byte_read after write %02x", value);
+    word = 0xCAFEF00D;
+    eeprom_write(&eep, 0xC4, (uint8_t *) &word, 4);
+    back = 0;
+    CHECK(at24c256_get(&eep, 0xC4, &back, 4) == EEPROM_OK && back == word, "get after write %08lx", (unsigned long) back);
+}
+
+/**
+ * @brief  The read back paths see the data of the cache
+ */
+static void test_update_fill(void) {
+    eeprom eep;
+    uint8_t *memory = test_part(&eep, 64);
+    uint16_t mismatch = 0;
+
+    for (uint16_t i = 0; i < TEST_MAX_SPAN; ++i) {
+        test_data[i] = (uint8_t) (i * 7 + 1);
+    }
+    eeprom_write(&eep, 20, test_data, TEST_MAX_SPAN);
+    CHECK(eeprom_verify(&eep, 20, test_data, TEST_MAX_SPAN, &mismatch) == EEPROM_OK && mismatch == TEST_MAX_SPAN, "verify %u", mismatch);
+    memory[20 + 33] ^= 1;
+    CHECK(eeprom_verify(&eep, 20, test_data, TEST_MAX_SPAN, &mismatch) == EEPROM_OK && mismatch == 33, "mismatch %u", mismatch);
+
+    test_data[50] ^= 0x80;
+    CHECK(eeprom_update(&eep, 20, test_data, TEST_MAX_SPAN) == EEPROM_OK, "update");
+    CHECK(memcmp(memory + 20, test_data, TEST_MAX_SPAN) == 0, "chip after update");
+
+    CHECK(eeprom_fill_update(&eep, 0, 0x3C, 256) == EEPROM_OK, "fill");
+    eeprom_read(&eep, 20, test_data, TEST_MAX_SPAN);
+    for (uint16_t i = 0; i < 256; ++i) {
+        CHECK(memory[i] == 0x3C, "fill at %u", i);
+    }
+    CHECK(test_data[0] == 0x3C && test_data[TEST_MAX_SPAN - 1] == 0x3C, "read after fill");
+}
+
+/**
+ * @brief  A synced log has its records on the chip and reopens where it left off
+ */
+static void test_log(void) {
+    static uint8_t page[64];
+    eeprom eep, fresh;
+    eeprom_log log;
+    uint8_t *memory = test_part(&eep, 256);
+    uint32_t record;
+
+    CHECK(eeprom_log_init(&log, &eep, 0, 16, 4, page) == EEPROM_OK, "init");
+    for (record = 0; record < 50; ++record) {
+        eeprom_log_append(&log, (uint8_t *) &record);
+    }
+    CHECK(eeprom_log_sync(&log) == EEPROM_OK, "sync");
+    record = 49;
+    CHECK(memcmp(memory + 64 * 3 + EEPROM_LOG_HEADER + 4 * 7, &record, 4) == 0, "last record on the chip");
+
+    eeprom_init(&fresh, TEST_ADDRESS, 256);
+    CHECK(eeprom_log_init(&log, &fresh, 0, 16, 4, page) == EEPROM_OK, "reopen");
+    CHECK(eeprom_log_records(&log) == 50, "records %lu", (unsigned long) eeprom_log_records(&log));
+    CHECK(eeprom_log_read(&log, 31, (uint8_t *) &record) == EEPROM_OK && record == 31, "record %lu", (unsigned long) record);
+}
+
+/**
+ * @brief  Values survive compaction and a reopen with an empty cache
+ */
+static void test_kv(void) {
+    static uint8_t page[64];
+    eeprom eep, fresh;
+    eeprom_kv kv;
+    uint32_t value;
+
+    test_part(&eep, 256);
+    CHECK(eeprom_kv_init(&kv, &eep, 0x1000, 8, page) == EEPROM_OK, "init");
+    for (value = 0; value < 300; ++value) {                                         // several compactions
+        CHECK(eeprom_kv_put(&kv, (eeprom_kv_key) (1 + value % 5), (uint8_t *) &value, 4) == EEPROM_OK, "put %lu", (unsigned long) value);
+    }
+    eeprom_init(&fresh, TEST_ADDRESS, 256);
+    CHECK(eeprom_kv_init(&kv, &fresh, 0x1000, 8, page) == EEPROM_OK, "reopen");
+    for (uint8_t key = 1; key <= 5; ++key) {
+        value = 0;
+        CHECK(eeprom_kv_get(&kv, key, (uint8_t *) &value, 4) == 4 && value == 294u + key, "key %u holds %lu", key, (unsigned long) value);
+    }
+}
+
+int main(void) {
+    printf("cache pages %u, read-ahead %u bytes\n", EEPROM_CACHE_PAGES, EEPROM_READAHEAD);
+    test_random_access();
+    test_direct_writes();
+    test_update_fill();
+    test_log();
+    test_kv();
+    printf("%s, %u failures\n", test_failures ? "FAILED" : "passed", test_failures);
+    return test_failures != 0;
+}